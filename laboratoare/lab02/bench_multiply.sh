@@ -0,0 +1,37 @@
+#!/bin/bash
+
+# Afiseaza GOPS-ul lui multiply_outer, al fiecarui micro-kernel din gemm.h suportat de
+# procesor (multiply_blocked, fara TRMM) si al lui multiply_recursive
+# Utilizare: ./bench_multiply.sh [P] [N...]
+
+P=${1:-4}
+shift
+SIZES=${@:-512 1000 2048}
+
+for binary in multiply_outer multiply_blocked multiply_recursive
+do
+    if [ ! -f "$binary" ]
+    then
+        echo "Nu exista binarul $binary"
+        exit
+    fi
+done
+
+for N in $SIZES
+do
+    # multiply_outer nu se cronometreaza singur: timpul include init si print
+    start=$(date +%s.%N)
+    ./multiply_outer $N $P > /dev/null
+    end=$(date +%s.%N)
+    echo "N=$N P=$P outer: $(echo "$start $end $N" | awk '{ t = $2 - $1; printf "%.3f s, %.2f GOPS", t, 2 * $3 * $3 * $3 / t / 1e9 }')"
+
+    for kernel in scalar sse4.1 avx2 avx512
+    do
+        GEMM_KERNEL=$kernel ./multiply_blocked 1 1 > /dev/null 2>&1 || continue
+        echo -n "N=$N P=$P blocked "
+        GEMM_KERNEL=$kernel ./multiply_blocked $N $P --no-trmm 2>&1 > /dev/null
+    done
+
+    echo -n "N=$N P=$P "
+    ./multiply_recursive $N $P 2>&1 > /dev/null
+done
@@ -0,0 +1,577 @@
+// Cache-blocked int32 matrix multiplication (C += A * B) for the multiply programs.
+//
+// The matrices are contiguous and row-major, with a leading dimension (the distance
+// between two rows, in elements). The loops follow the usual GotoBLAS structure: a
+// KC x NC panel of B is packed once into slivers of NR columns, which stay in the L3
+// cache; every thread then packs MC x KC blocks of A into slivers of MR rows, which stay
+// in the L2 cache, and multiplies them with the panel one MR x NR block of C at a time.
+// The block of C is kept in registers for the whole KC loop. The threads split the MC
+// blocks of every panel, so they never write to the same element of C. Integer sums do
+// not depend on their order, so the result is the same as with the naive loops.
+//
+// The MR x NR micro-kernel is chosen at run time among a scalar one and the SSE4.1, AVX2
+// and AVX-512 ones the processor supports (cpuid); MR and NR depend on the kernel.
+//
+// When A or B is upper triangular (gemm_set_upper), the products with their zero
+// elements are skipped: every MR x NR block of C only runs the micro-kernel over the k
+// range where both slivers can be nonzero, and the blocks of A below the diagonal of a
+// panel are neither packed nor multiplied. The MC blocks are then split among the threads
+// by their amount of work rather than by their number.
+//
+// Exactly one source file must define GEMM_IMPLEMENTATION before including this header.
+
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <pthread.h>
+
+#define GEMM_MAX_MR     12
+#define GEMM_MAX_NR     32
+#define GEMM_KC         256
+#define GEMM_MC         96          // Multiple of every MR
+#define GEMM_NC         2048        // Multiple of every NR
+#define GEMM_ALIGN      64
+
+// c[MR][NR] (with leading dimension ldc) += the product of a sliver of A and one of B
+typedef void (*gemm_kernel_fn)(int kc, const int *a, const int *b, int *c, int ldc);
+
+typedef struct {
+    const char *name;
+    int mr, nr;
+    gemm_kernel_fn fn;
+} gemm_kernel;
+
+typedef struct {
+    int m, n, k;
+    const int *a;
+    int lda;
+    const int *b;
+    int ldb;
+    int *c;
+    int ldc;
+    int num_threads;
+    const gemm_kernel *kernel;
+    int upper_a, upper_b;           // Zero below the diagonal
+    int *bounds;                    // Thread t computes the MC blocks [bounds[t], bounds[t + 1])
+    int *packed_b;                  // KC x NC panel of B, shared by the threads
+    int **packed_a;                 // One MC x KC block of A per thread
+    pthread_barrier_t barrier;
+} gemm_plan;
+
+// Allocates a zeroed rows x cols matrix, aligned to GEMM_ALIGN bytes. Exits on failure.
+int *gemm_alloc(int rows, int cols);
+
+// Builds row pointers into a contiguous matrix, for the code that indexes it as mat[i][j]
+int **gemm_rows(int *matrix, int rows, int cols);
+
+// Returns the kernel called `name` ("scalar", "sse4.1", "avx2" or "avx512"), or the
+// fastest one the processor supports when `name` is NULL. Returns NULL when the kernel
+// is unknown or not supported.
+const gemm_kernel *gemm_select_kernel(const char *name);
+
+// Prepares C (m x n) += A (m x k) * B (k x n) for `num_threads` threads, with `kernel`
+// (NULL selects the fastest one). Exits on failure.
+void gemm_init(gemm_plan *plan, int m, int n, int k, const int *a, int lda,
+               const int *b, int ldb, int *c, int ldc, int num_threads,
+               const gemm_kernel *kernel);
+
+// Points the plan to other matrices, keeping its threads, kernel and buffers, so that
+// many products can be computed without allocating. The triangular flags are cleared.
+void gemm_set_operands(gemm_plan *plan, int m, int n, int k, const int *a, int lda,
+                       const int *b, int ldb, int *c, int ldc);
+
+// Tells whether the rows x cols matrix is zero below its diagonal
+int gemm_is_upper(const int *matrix, int rows, int cols, int ld);
+
+// Declares that A and / or B are upper triangular, so their zeros are skipped. The
+// result is the same, since the skipped products are all zero.
+void gemm_set_upper(gemm_plan *plan, int upper_a, int upper_b);
+
+// Computes the share of thread `thread_id`. Every thread of the plan must call it, since
+// the threads wait for each other while the panels of B are packed.
+void gemm_thread(gemm_plan *plan, int thread_id);
+
+void gemm_destroy(gemm_plan *plan);
+
+#ifdef GEMM_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GEMM_X86
+#include <immintrin.h>
+#endif
+
+#define gemm_min(a, b) ((a) > (b) ? (b) : (a))
+
+int *gemm_alloc(int rows, int cols)
+{
+    void *matrix;
+    size_t size = (size_t)rows * cols * sizeof(int);
+
+    if (posix_memalign(&matrix, GEMM_ALIGN, size ? size : GEMM_ALIGN)) {
+        printf("Eroare la malloc!");
+        exit(1);
+    }
+
+    memset(matrix, 0, size);
+    return matrix;
+}
+
+int **gemm_rows(int *matrix, int rows, int cols)
+{
+    int **mat = malloc(sizeof(int *) * (rows ? rows : 1));
+    if (mat == NULL) {
+        printf("Eroare la malloc!");
+        exit(1);
+    }
+
+    for (int i = 0; i < rows; i++) {
+        mat[i] = matrix + (size_t)i * cols;
+    }
+    return mat;
+}
+
+static void gemm_kernel_scalar(int kc, const int *a, const int *b, int *c, int ldc)
+{
+    int acc[4][8] = {{0}};
+
+    for (int p = 0; p < kc; p++) {
+        for (int i = 0; i < 4; i++) {
+            int ai = a[i];
+
+            for (int j = 0; j < 8; j++) {
+                acc[i][j] += ai * b[j];
+            }
+        }
+        a += 4;
+        b += 8;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 8; j++) {
+            c[(size_t)i * ldc + j] += acc[i][j];
+        }
+    }
+}
+
+#ifdef GEMM_X86
+
+// 6 x 8: two 4-lane accumulators per row (pmulld is SSE4.1)
+__attribute__((target("sse4.1")))
+static void gemm_kernel_sse41(int kc, const int *a, const int *b, int *c, int ldc)
+{
+    __m128i acc[6][2];
+
+#pragma GCC unroll 6
+    for (int i = 0; i < 6; i++) {
+        acc[i][0] = _mm_setzero_si128();
+        acc[i][1] = _mm_setzero_si128();
+    }
+
+    for (int p = 0; p < kc; p++) {
+        __m128i b0 = _mm_load_si128((const __m128i *)b);
+        __m128i b1 = _mm_load_si128((const __m128i *)(b + 4));
+
+#pragma GCC unroll 6
+        for (int i = 0; i < 6; i++) {
+            __m128i ai = _mm_set1_epi32(a[i]);
+
+            acc[i][0] = _mm_add_epi32(acc[i][0], _mm_mullo_epi32(ai, b0));
+            acc[i][1] = _mm_add_epi32(acc[i][1], _mm_mullo_epi32(ai, b1));
+        }
+        a += 6;
+        b += 8;
+    }
+
+#pragma GCC unroll 6
+    for (int i = 0; i < 6; i++) {
+        __m128i *row = (__m128i *)(c + (size_t)i * ldc);
+
+        _mm_storeu_si128(row, _mm_add_epi32(_mm_loadu_si128(row), acc[i][0]));
+        _mm_storeu_si128(row + 1, _mm_add_epi32(_mm_loadu_si128(row + 1), acc[i][1]));
+    }
+}
+
+// 6 x 16: 12 of the 16 ymm registers hold the block of C
+__attribute__((target("avx2")))
+static void gemm_kernel_avx2(int kc, const int *a, const int *b, int *c, int ldc)
+{
+    __m256i acc[6][2];
+
+#pragma GCC unroll 6
+    for (int i = 0; i < 6; i++) {
+        acc[i][0] = _mm256_setzero_si256();
+        acc[i][1] = _mm256_setzero_si256();
+    }
+
+    for (int p = 0; p < kc; p++) {
+        __m256i b0 = _mm256_load_si256((const __m256i *)b);
+        __m256i b1 = _mm256_load_si256((const __m256i *)(b + 8));
+
+#pragma GCC unroll 6
+        for (int i = 0; i < 6; i++) {
+            __m256i ai = _mm256_set1_epi32(a[i]);
+
+            acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_mullo_epi32(ai, b0));
+            acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_mullo_epi32(ai, b1));
+        }
+        a += 6;
+        b += 16;
+    }
+
+#pragma GCC unroll 6
+    for (int i = 0; i < 6; i++) {
+        __m256i *row = (__m256i *)(c + (size_t)i * ldc);
+
+        _mm256_storeu_si256(row, _mm256_add_epi32(_mm256_loadu_si256(row), acc[i][0]));
+        _mm256_storeu_si256(row + 1, _mm256_add_epi32(_mm256_loadu_si256(row + 1), acc[i][1]));
+    }
+}
+
+// 12 x 32: 24 of the 32 zmm registers hold the block of C
+__attribute__((target("avx512f")))
+static void gemm_kernel_avx512(int kc, const int *a, const int *b, int *c, int ldc)
+{
+    __m512i acc[12][2];
+
+#pragma GCC unroll 12
+    for (int i = 0; i < 12; i++) {
+        acc[i][0] = _mm512_setzero_si512();
+        acc[i][1] = _mm512_setzero_si512();
+    }
+
+    for (int p = 0; p < kc; p++) {
+        __m512i b0 = _mm512_load_si512((const void *)b);
+        __m512i b1 = _mm512_load_si512((const void *)(b + 16));
+
+#pragma GCC unroll 12
+        for (int i = 0; i < 12; i++) {
+            __m512i ai = _mm512_set1_epi32(a[i]);
+
+            acc[i][0] = _mm512_add_epi32(acc[i][0], _mm512_mullo_epi32(ai, b0));
+            acc[i][1] = _mm512_add_epi32(acc[i][1], _mm512_mullo_epi32(ai, b1));
+        }
+        a += 12;
+        b += 32;
+    }
+
+#pragma GCC unroll 12
+    for (int i = 0; i < 12; i++) {
+        int *row = c + (size_t)i * ldc;
+
+        _mm512_storeu_si512(row, _mm512_add_epi32(_mm512_loadu_si512(row), acc[i][0]));
+        _mm512_storeu_si512(row + 16, _mm512_add_epi32(_mm512_loadu_si512(row + 16), acc[i][1]));
+    }
+}
+
+#endif
+
+// Fastest first
+static const gemm_kernel gemm_kernels[] = {
+#ifdef GEMM_X86
+    { "avx512", 12, 32, gemm_kernel_avx512 },
+    { "avx2", 6, 16, gemm_kernel_avx2 },
+    { "sse4.1", 6, 8, gemm_kernel_sse41 },
+#endif
+    { "scalar", 4, 8, gemm_kernel_scalar },
+};
+
+static int gemm_kernel_supported(const gemm_kernel *kernel)
+{
+#ifdef GEMM_X86
+    __builtin_cpu_init();
+    if (!strcmp(kernel->name, "avx512")) {
+        return __builtin_cpu_supports("avx512f");
+    }
+    if (!strcmp(kernel->name, "avx2")) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (!strcmp(kernel->name, "sse4.1")) {
+        return __builtin_cpu_supports("sse4.1");
+    }
+#endif
+    return 1;
+}
+
+const gemm_kernel *gemm_select_kernel(const char *name)
+{
+    for (size_t i = 0; i < sizeof(gemm_kernels) / sizeof(gemm_kernels[0]); i++) {
+        const gemm_kernel *kernel = &gemm_kernels[i];
+
+        if ((name == NULL || !strcmp(name, kernel->name)) && gemm_kernel_supported(kernel)) {
+            return kernel;
+        }
+    }
+    return NULL;
+}
+
+int gemm_is_upper(const int *matrix, int rows, int cols, int ld)
+{
+    for (int i = 1; i < rows; i++) {
+        for (int j = 0; j < i && j < cols; j++) {
+            if (matrix[(size_t)i * ld + j]) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Number of products with a nonzero A and B element in row i of C
+static double gemm_row_work(const gemm_plan *plan, int i)
+{
+    int lo = plan->upper_a ? i : 0;
+    double work = 0;
+
+    if (!plan->upper_b) {
+        return (double)plan->n * (plan->k > lo ? plan->k - lo : 0);
+    }
+
+    // Only k <= j is nonzero in column j of B
+    for (int j = 0; j < plan->n; j++) {
+        int hi = gemm_min(j + 1, plan->k);
+
+        work += hi > lo ? hi - lo : 0;
+    }
+    return work;
+}
+
+// Splits the MC blocks into num_threads contiguous ranges with about the same work
+static void gemm_balance(gemm_plan *plan)
+{
+    int blocks = (plan->m + GEMM_MC - 1) / GEMM_MC;
+    double *prefix = malloc(sizeof(double) * (blocks + 1));
+    if (prefix == NULL) {
+        printf("Eroare la malloc!");
+        exit(1);
+    }
+
+    prefix[0] = 0;
+    for (int block = 0; block < blocks; block++) {
+        double work = 0;
+
+        for (int i = block * GEMM_MC; i < gemm_min((block + 1) * GEMM_MC, plan->m); i++) {
+            work += gemm_row_work(plan, i);
+        }
+        prefix[block + 1] = prefix[block] + work;
+    }
+
+    // Thread t starts at the first block where the work before it reaches t / P of the total
+    int block = 0;
+    for (int t = 0; t < plan->num_threads; t++) {
+        double target = prefix[blocks] * t / plan->num_threads;
+
+        while (block < blocks && prefix[block] < target) {
+            block++;
+        }
+        plan->bounds[t] = block;
+    }
+    plan->bounds[plan->num_threads] = blocks;
+
+    free(prefix);
+}
+
+void gemm_set_upper(gemm_plan *plan, int upper_a, int upper_b)
+{
+    plan->upper_a = upper_a;
+    plan->upper_b = upper_b;
+    gemm_balance(plan);
+}
+
+void gemm_set_operands(gemm_plan *plan, int m, int n, int k, const int *a, int lda,
+                       const int *b, int ldb, int *c, int ldc)
+{
+    plan->m = m;
+    plan->n = n;
+    plan->k = k;
+    plan->a = a;
+    plan->lda = lda;
+    plan->b = b;
+    plan->ldb = ldb;
+    plan->c = c;
+    plan->ldc = ldc;
+    plan->upper_a = 0;
+    plan->upper_b = 0;
+    gemm_balance(plan);
+}
+
+void gemm_init(gemm_plan *plan, int m, int n, int k, const int *a, int lda,
+               const int *b, int ldb, int *c, int ldc, int num_threads,
+               const gemm_kernel *kernel)
+{
+    plan->num_threads = num_threads;
+    plan->kernel = kernel ? kernel : gemm_select_kernel(NULL);
+
+    plan->packed_b = gemm_alloc(GEMM_KC, GEMM_NC);
+    plan->packed_a = malloc(sizeof(int *) * num_threads);
+    plan->bounds = malloc(sizeof(int) * (num_threads + 1));
+    if (plan->packed_a == NULL || plan->bounds == NULL) {
+        printf("Eroare la malloc!");
+        exit(1);
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        plan->packed_a[i] = gemm_alloc(GEMM_MC, GEMM_KC);
+    }
+
+    gemm_set_operands(plan, m, n, k, a, lda, b, ldb, c, ldc);
+    pthread_barrier_init(&plan->barrier, NULL, num_threads);
+}
+
+void gemm_destroy(gemm_plan *plan)
+{
+    for (int i = 0; i < plan->num_threads; i++) {
+        free(plan->packed_a[i]);
+    }
+    free(plan->packed_a);
+    free(plan->bounds);
+    free(plan->packed_b);
+    pthread_barrier_destroy(&plan->barrier);
+}
+
+// Packs the slivers [start, end) of the kc x nc block of B at `b`: sliver s holds, for
+// every p, the nr elements b[p][s * nr ...], padded with zeros
+static void gemm_pack_b(const int *b, int ldb, int kc, int nc, int nr, int *packed,
+                        int start, int end)
+{
+    for (int s = start; s < end; s++) {
+        int *dst = packed + (size_t)s * nr * kc;
+        int cols = gemm_min(nr, nc - s * nr);
+
+        for (int p = 0; p < kc; p++) {
+            const int *src = b + (size_t)p * ldb + s * nr;
+            int j;
+
+            for (j = 0; j < cols; j++) {
+                dst[j] = src[j];
+            }
+            for (; j < nr; j++) {
+                dst[j] = 0;
+            }
+            dst += nr;
+        }
+    }
+}
+
+// Packs the mc x kc block of A at `a` as slivers of mr rows: sliver s holds, for every p,
+// the mr elements a[s * mr ...][p], padded with zeros
+static void gemm_pack_a(const int *a, int lda, int mc, int kc, int mr, int *packed)
+{
+    for (int s = 0; s * mr < mc; s++) {
+        int *dst = packed + (size_t)s * mr * kc;
+        int rows = gemm_min(mr, mc - s * mr);
+
+        for (int p = 0; p < kc; p++) {
+            int i;
+
+            for (i = 0; i < rows; i++) {
+                dst[i] = a[(size_t)(s * mr + i) * lda + p];
+            }
+            for (; i < mr; i++) {
+                dst[i] = 0;
+            }
+            dst += mr;
+        }
+    }
+}
+
+// Multiplies a packed mc x kc block of A with a packed kc x nc panel of B into C. The
+// block starts at row ic of A and the panel at row pc and column jc of B, which is where
+// the zeros are when they are triangular.
+static void gemm_macro_kernel(const gemm_plan *plan, int ic, int jc, int pc, int mc, int nc,
+                              int kc, const int *packed_a, const int *packed_b, int *c, int ldc)
+{
+    const gemm_kernel *kernel = plan->kernel;
+    int mr = kernel->mr, nr = kernel->nr;
+    int edge[GEMM_MAX_MR * GEMM_MAX_NR];
+
+    for (int jr = 0; jr < nc; jr += nr) {
+        int cols = gemm_min(nr, nc - jr);
+
+        for (int ir = 0; ir < mc; ir += mr) {
+            int rows = gemm_min(mr, mc - ir);
+
+            // Only a[i][k] with k >= i and b[k][j] with k <= j can be nonzero
+            int first = plan->upper_a && ic + ir > pc ? ic + ir - pc : 0;
+            int last = plan->upper_b ? gemm_min(jc + jr + cols - pc, kc) : kc;
+            if (last <= first) {
+                continue;
+            }
+
+            const int *a = packed_a + (size_t)ir * kc + (size_t)first * mr;
+            const int *b = packed_b + (size_t)jr * kc + (size_t)first * nr;
+            int *dst = c + (size_t)ir * ldc + jr;
+
+            if (rows == mr && cols == nr) {
+                kernel->fn(last - first, a, b, dst, ldc);
+                continue;
+            }
+
+            // Partial blocks at the edges of C go through a full-sized buffer
+            memset(edge, 0, sizeof(int) * mr * nr);
+            kernel->fn(last - first, a, b, edge, nr);
+            for (int i = 0; i < rows; i++) {
+                for (int j = 0; j < cols; j++) {
+                    dst[(size_t)i * ldc + j] += edge[i * nr + j];
+                }
+            }
+        }
+    }
+}
+
+void gemm_thread(gemm_plan *plan, int thread_id)
+{
+    int P = plan->num_threads;
+    const gemm_kernel *kernel = plan->kernel;
+    int *packed_a = plan->packed_a[thread_id];
+
+    // Every thread owns a contiguous range of the MC blocks of C
+    int first = plan->bounds[thread_id];
+    int last = plan->bounds[thread_id + 1];
+
+    for (int jc = 0; jc < plan->n; jc += GEMM_NC) {
+        int nc = gemm_min(GEMM_NC, plan->n - jc);
+        int slivers = (nc + kernel->nr - 1) / kernel->nr;
+
+        for (int pc = 0; pc < plan->k; pc += GEMM_KC) {
+            int kc = gemm_min(GEMM_KC, plan->k - pc);
+
+            // The threads pack the panel of B together
+            int start = thread_id * (double)slivers / P;
+            int end = gemm_min((thread_id + 1) * (double)slivers / P, slivers);
+
+            // The slivers left of the diagonal of a triangular B are zero and never read
+            if (plan->upper_b && start < (pc - jc) / kernel->nr) {
+                start = gemm_min((pc - jc) / kernel->nr, end);
+            }
+            gemm_pack_b(plan->b + (size_t)pc * plan->ldb + jc, plan->ldb, kc, nc, kernel->nr,
+                        plan->packed_b, start, end);
+            pthread_barrier_wait(&plan->barrier);
+
+            for (int block = first; block < last; block++) {
+                int ic = block * GEMM_MC;
+                int mc = gemm_min(GEMM_MC, plan->m - ic);
+
+                // The rows of a triangular A are zero before the diagonal
+                if (plan->upper_a && ic >= pc + kc) {
+                    break;
+                }
+
+                gemm_pack_a(plan->a + (size_t)ic * plan->lda + pc, plan->lda, mc, kc,
+                            kernel->mr, packed_a);
+                gemm_macro_kernel(plan, ic, jc, pc, mc, nc, kc, packed_a, plan->packed_b,
+                                  plan->c + (size_t)ic * plan->ldc + jc, plan->ldc);
+            }
+
+            // The panel is overwritten by the next iteration
+            pthread_barrier_wait(&plan->barrier);
+        }
+    }
+}
+
+#endif
+
+#endif
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#define TRACE_IMPLEMENTATION
+#include "trace.h"
+
+#define GEMM_IMPLEMENTATION
+#include "gemm.h"
+
+int N;
+int P;
+int trmm = 1;
+int **a;
+int **b;
+int **c;
+
+// matricele sunt contigue si aliniate; a, b si c sunt pointeri la liniile lor
+int *A;
+int *B;
+int *C;
+
+gemm_plan plan;
+
+// fiecare thread inmulteste blocurile lui de linii din c (vezi gemm.h)
+void *thread_function(void *arg)
+{
+	int thread_id = *(int *)arg;
+
+	trace_thread("thread", thread_id);
+	trace_begin("multiply");
+
+	gemm_thread(&plan, thread_id);
+
+	trace_end("multiply");
+	pthread_exit(NULL);
+}
+
+void get_args(int argc, char **argv)
+{
+	if(argc < 3) {
+		printf("Numar insuficient de parametri: ./program N P [--no-trmm]\n");
+		exit(1);
+	}
+
+	N = atoi(argv[1]);
+	P = atoi(argv[2]);
+
+	// --no-trmm inmulteste si zerourile matricelor triunghiulare
+	trmm = !(argc > 3 && !strcmp(argv[3], "--no-trmm"));
+}
+
+void init()
+{
+	A = gemm_alloc(N, N);
+	B = gemm_alloc(N, N);
+	C = gemm_alloc(N, N);
+
+	a = gemm_rows(A, N, N);
+	b = gemm_rows(B, N, N);
+	c = gemm_rows(C, N, N);
+
+	int i, j;
+	for (i = 0; i < N; i++) {
+		for(j = 0; j < N; j++) {
+			c[i][j] = 0;
+
+			if(i <= j) {
+				a[i][j] = 1;
+				b[i][j] = 1;
+			} else {
+				a[i][j] = 0;
+				b[i][j] = 0;
+			}
+		}
+	}
+
+	// $GEMM_KERNEL forteaza un anumit micro-kernel (scalar, sse4.1, avx2, avx512)
+	const char *name = getenv("GEMM_KERNEL");
+	const gemm_kernel *kernel = gemm_select_kernel(name);
+	if (kernel == NULL) {
+		printf("Kernel necunoscut sau nesuportat: %s\n", name);
+		exit(1);
+	}
+
+	gemm_init(&plan, N, N, N, A, N, B, N, C, N, P, kernel);
+
+	// a si b sunt superior triunghiulare, deci blocurile de zerouri pot fi sarite
+	if (trmm) {
+		gemm_set_upper(&plan, gemm_is_upper(A, N, N, N), gemm_is_upper(B, N, N, N));
+	}
+}
+
+void print(int **mat)
+{
+	int i, j;
+
+	for (i = 0; i < N; i++) {
+		for(j = 0; j < N; j++) {
+			printf("%i\t", mat[i][j]);
+		}
+		printf("\n");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	get_args(argc, argv);
+	init();
+
+	trace_init(getenv("TRACE_FILE"));
+	trace_thread("main", 0);
+
+	pthread_t tid[P];
+	int thread_id[P];
+	struct timespec t0, t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (i = 0; i < P; i++) {
+		thread_id[i] = i;
+		pthread_create(&tid[i], NULL, thread_function, &thread_id[i]);
+	}
+
+	for (i = 0; i < P; i++) {
+		pthread_join(tid[i], NULL);
+	}
+
+	// timpul si GOPS (o inmultire si o adunare pe element) merg la stderr, ca
+	// rezultatul de la stdout sa poata fi comparat cu multiply_seq
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	// cu TRMM, GOPS-ul este cel efectiv, raportat la inmultirea completa
+	fprintf(stderr, "%s %dx%d%s: %.3f s, %.2f GOPS\n", plan.kernel->name, plan.kernel->mr,
+			plan.kernel->nr, plan.upper_a || plan.upper_b ? " trmm" : "", seconds,
+			2.0 * N * N * N / seconds / 1e9);
+
+	print(c);
+
+	gemm_destroy(&plan);
+
+	return 0;
+}
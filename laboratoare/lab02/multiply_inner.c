@@ -1,6 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <string.h>
+
+#define TRACE_IMPLEMENTATION
+#include "trace.h"
 
 #define min(a, b) a > b ? b : a
 
@@ -12,10 +16,69 @@ int **c;
 
 pthread_mutex_t mutex;
 
+// cu --ksplit, fiecare thread aduna in propria matrice partiala, fara mutex
+int ksplit;
+int **partial;
+int ld;
+pthread_barrier_t barrier;
+
+// dupa ce toate matricele partiale sunt complete, fiecare thread aduna direct in c,
+// intr-o singura trecere, cele P matrici partiale pe banda lui de linii; benzile sunt
+// disjuncte, deci nu este nevoie de mutex
+void reduce_partials(int start, int end)
+{
+	pthread_barrier_wait(&barrier);
+
+	for (int i = start; i < end; i++) {
+		for (int t = 0; t < P; t++) {
+			int *row = partial[t] + (size_t)i * ld;
+
+			for (int j = 0; j < N; j++) {
+				c[i][j] += row[j];
+			}
+		}
+	}
+}
+
+void *thread_function_ksplit(void *arg)
+{
+	int thread_id = *(int *)arg;
+
+	trace_thread("thread", thread_id);
+	trace_begin("multiply");
+
+	int start = thread_id * (double)N / P;
+	int end = min((thread_id + 1) * (double)N / P, N);
+	int *mine = partial[thread_id];
+
+	// intervalul de k al thread-ului, pentru toti i si j; ordinea i-k-j citeste b pe linii
+	for (int i = 0; i < N; i++) {
+		for (int k = start; k < end; k++) {
+			int aik = a[i][k];
+
+			for (int j = 0; j < N; j++) {
+				mine[(size_t)i * ld + j] += aik * b[k][j];
+			}
+		}
+	}
+
+	trace_end("multiply");
+	trace_begin("reduce");
+
+	// liniile reducerii sunt impartite ca intervalul de k
+	reduce_partials(start, end);
+
+	trace_end("reduce");
+	pthread_exit(NULL);
+}
+
 void *thread_function(void *arg)
 {
 	int thread_id = *(int *)arg;
 
+	trace_thread("thread", thread_id);
+	trace_begin("multiply");
+
 	int start = thread_id * (double)N / P;
     int end = min((thread_id + 1) * (double)N / P, N);
 
@@ -32,18 +95,39 @@ void *thread_function(void *arg)
 		}
 	}
 
+	trace_end("multiply");
 	pthread_exit(NULL);
 }
 
 void get_args(int argc, char **argv)
 {
 	if(argc < 3) {
-		printf("Numar insuficient de parametri: ./program N P\n");
+		printf("Numar insuficient de parametri: ./program N P [--ksplit]\n");
 		exit(1);
 	}
 
 	N = atoi(argv[1]);
 	P = atoi(argv[2]);
+	ksplit = argc > 3 && !strcmp(argv[3], "--ksplit");
+}
+
+// P matrici partiale zero, aliniate la 64 de octeti, cu liniile multiplu de 64 de octeti
+void init_partials()
+{
+	ld = (N + 15) / 16 * 16;
+	partial = malloc(sizeof(int *) * P);
+	if (partial == NULL) {
+		printf("Eroare la malloc!");
+		exit(1);
+	}
+
+	for (int t = 0; t < P; t++) {
+		if (posix_memalign((void **)&partial[t], 64, sizeof(int) * ld * (N ? N : 1))) {
+			printf("Eroare la malloc!");
+			exit(1);
+		}
+		memset(partial[t], 0, sizeof(int) * ld * N);
+	}
 }
 
 void init()
@@ -103,6 +187,9 @@ int main(int argc, char *argv[])
 	get_args(argc, argv);
 	init();
 
+	trace_init(getenv("TRACE_FILE"));
+	trace_thread("main", 0);
+
 	pthread_t tid[P];
 	int thread_id[P];
 
@@ -112,9 +199,15 @@ int main(int argc, char *argv[])
 		exit(-1);
 	}
 
+	if (ksplit) {
+		init_partials();
+		pthread_barrier_init(&barrier, NULL, P);
+	}
+
 	for (i = 0; i < P; i++) {
 		thread_id[i] = i;
-		pthread_create(&tid[i], NULL, thread_function, &thread_id[i]);
+		pthread_create(&tid[i], NULL, ksplit ? thread_function_ksplit : thread_function,
+					   &thread_id[i]);
 	}
 
 	for (i = 0; i < P; i++) {
@@ -122,6 +215,15 @@ int main(int argc, char *argv[])
 	}
 
 	print(c);
+
+	if (ksplit) {
+		pthread_barrier_destroy(&barrier);
+		for (i = 0; i < P; i++) {
+			free(partial[i]);
+		}
+		free(partial);
+	}
+
 	r = pthread_mutex_destroy(&mutex);
 	if (r) {
 		printf ("Mutex cannot be destroyed.\n");
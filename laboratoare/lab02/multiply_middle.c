@@ -2,6 +2,9 @@
 #include <stdlib.h>
 #include <pthread.h>
 
+#define TRACE_IMPLEMENTATION
+#include "trace.h"
+
 #define min(a, b) a > b ? b : a
 
 int N;
@@ -14,6 +17,9 @@ void *thread_function(void *arg)
 {
 	int thread_id = *(int *)arg;
 
+	trace_thread("thread", thread_id);
+	trace_begin("multiply");
+
 	int start = thread_id * (double)N / P;
     int end = min((thread_id + 1) * (double)N / P, N);
 	
@@ -25,6 +31,7 @@ void *thread_function(void *arg)
 		}
 	}
 
+	trace_end("multiply");
 	pthread_exit(NULL);
 }
 
@@ -96,6 +103,9 @@ int main(int argc, char *argv[])
 	get_args(argc, argv);
 	init();
 
+	trace_init(getenv("TRACE_FILE"));
+	trace_thread("main", 0);
+
 	pthread_t tid[P];
 	int thread_id[P];
 
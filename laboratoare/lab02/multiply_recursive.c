@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define TRACE_IMPLEMENTATION
+#include "trace.h"
+
+#define GEMM_IMPLEMENTATION
+#include "gemm.h"
+
+// sub-problemele cu toate dimensiunile sub BASE sunt inmultite direct
+#define BASE 128
+
+// C (m x n) += A (m x k) * B (k x n), in matricele N x N
+typedef struct Task {
+	int m, n, k;
+	const int *a;
+	const int *b;
+	int *c;
+	int pending;			// 1 pana cand task-ul este terminat
+	struct Task *next;
+} Task;
+
+int N;
+int P;
+int **a;
+int **b;
+int **c;
+
+// matricele sunt contigue si aliniate; a, b si c sunt pointeri la liniile lor
+int *A;
+int *B;
+int *C;
+
+// stiva de task-uri a thread pool-ului
+Task *stack;
+pthread_mutex_t mutex;
+pthread_cond_t cond;
+Task root;
+
+void push(Task *task)
+{
+	pthread_mutex_lock(&mutex);
+	task->next = stack;
+	stack = task;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+Task *pop()
+{
+	pthread_mutex_lock(&mutex);
+	Task *task = stack;
+	if (task) {
+		stack = task->next;
+	}
+	pthread_mutex_unlock(&mutex);
+	return task;
+}
+
+// planul GEMM al fiecarui thread, pentru cazul de baza
+gemm_plan *plans;
+
+void run(Task *task, gemm_plan *plan);
+
+// injumatateste cea mai mare dimensiune pana cand sub-problema incape in cache, oricare
+// ar fi marimea cache-ului: jumatatile lui m si n scriu in blocuri diferite din c, deci una
+// dintre ele devine task pentru pool; jumatatile lui k scriu in acelasi bloc, deci se
+// executa una dupa alta. Cazul de baza merge la micro-kernel-ul din gemm.h, pe thread-ul
+// curent.
+void multiply(int m, int n, int k, const int *a, const int *b, int *c, gemm_plan *plan)
+{
+	if (m <= BASE && n <= BASE && k <= BASE) {
+		gemm_set_operands(plan, m, n, k, a, N, b, N, c, N);
+		gemm_thread(plan, 0);
+		return;
+	}
+
+	if (k >= m && k >= n) {
+		multiply(m, n, k / 2, a, b, c, plan);
+		multiply(m, n, k - k / 2, a + k / 2, b + (size_t)(k / 2) * N, c, plan);
+		return;
+	}
+
+	Task half;
+	if (m >= n) {
+		half = (Task){ m - m / 2, n, k, a + (size_t)(m / 2) * N, b, c + (size_t)(m / 2) * N, 1 };
+		m /= 2;
+	} else {
+		half = (Task){ m, n - n / 2, k, a, b + n / 2, c + n / 2, 1 };
+		n /= 2;
+	}
+
+	push(&half);
+	multiply(m, n, k, a, b, c, plan);
+
+	// cat timp cealalta jumatate nu este gata, thread-ul executa alte task-uri
+	while (__atomic_load_n(&half.pending, __ATOMIC_ACQUIRE)) {
+		Task *task = pop();
+
+		if (task) {
+			run(task, plan);
+		} else {
+			sched_yield();
+		}
+	}
+}
+
+void run(Task *task, gemm_plan *plan)
+{
+	multiply(task->m, task->n, task->k, task->a, task->b, task->c, plan);
+	__atomic_store_n(&task->pending, 0, __ATOMIC_RELEASE);
+
+	// thread-urile care asteapta radacina sunt trezite la final
+	if (task == &root) {
+		pthread_mutex_lock(&mutex);
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&mutex);
+	}
+}
+
+// fiecare thread executa task-uri din stiva pana cand radacina este gata
+void *thread_function(void *arg)
+{
+	int thread_id = *(int *)arg;
+
+	trace_thread("thread", thread_id);
+	trace_begin("multiply");
+
+	while (__atomic_load_n(&root.pending, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&mutex);
+		while (stack == NULL && __atomic_load_n(&root.pending, __ATOMIC_ACQUIRE)) {
+			pthread_cond_wait(&cond, &mutex);
+		}
+
+		Task *task = stack;
+		if (task) {
+			stack = task->next;
+		}
+		pthread_mutex_unlock(&mutex);
+
+		if (task) {
+			run(task, &plans[thread_id]);
+		}
+	}
+
+	trace_end("multiply");
+	pthread_exit(NULL);
+}
+
+void get_args(int argc, char **argv)
+{
+	if(argc < 3) {
+		printf("Numar insuficient de parametri: ./program N P\n");
+		exit(1);
+	}
+
+	N = atoi(argv[1]);
+	P = atoi(argv[2]);
+}
+
+void init()
+{
+	A = gemm_alloc(N, N);
+	B = gemm_alloc(N, N);
+	C = gemm_alloc(N, N);
+
+	a = gemm_rows(A, N, N);
+	b = gemm_rows(B, N, N);
+	c = gemm_rows(C, N, N);
+
+	int i, j;
+	for (i = 0; i < N; i++) {
+		for(j = 0; j < N; j++) {
+			c[i][j] = 0;
+
+			if(i <= j) {
+				a[i][j] = 1;
+				b[i][j] = 1;
+			} else {
+				a[i][j] = 0;
+				b[i][j] = 0;
+			}
+		}
+	}
+
+	plans = malloc(sizeof(gemm_plan) * P);
+	if (plans == NULL) {
+		printf("Eroare la malloc!");
+		exit(1);
+	}
+	for (i = 0; i < P; i++) {
+		gemm_init(&plans[i], 0, 0, 0, A, N, B, N, C, N, 1, NULL);
+	}
+
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
+
+	root = (Task){ N, N, N, A, B, C, 1 };
+	stack = N > 0 ? &root : NULL;
+	root.pending = N > 0;
+}
+
+void print(int **mat)
+{
+	int i, j;
+
+	for (i = 0; i < N; i++) {
+		for(j = 0; j < N; j++) {
+			printf("%i\t", mat[i][j]);
+		}
+		printf("\n");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	get_args(argc, argv);
+	init();
+
+	trace_init(getenv("TRACE_FILE"));
+	trace_thread("main", 0);
+
+	pthread_t tid[P];
+	int thread_id[P];
+	struct timespec t0, t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (i = 0; i < P; i++) {
+		thread_id[i] = i;
+		pthread_create(&tid[i], NULL, thread_function, &thread_id[i]);
+	}
+
+	for (i = 0; i < P; i++) {
+		pthread_join(tid[i], NULL);
+	}
+
+	// timpul si GOPS-ul merg la stderr, ca in multiply_blocked
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	fprintf(stderr, "recursive %s %d: %.3f s, %.2f GOPS\n", plans[0].kernel->name, BASE, seconds,
+			2.0 * N * N * N / seconds / 1e9);
+
+	print(c);
+
+	for (i = 0; i < P; i++) {
+		gemm_destroy(&plans[i]);
+	}
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&cond);
+
+	return 0;
+}
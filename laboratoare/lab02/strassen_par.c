@@ -0,0 +1,412 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define TRACE_IMPLEMENTATION
+#include "trace.h"
+
+#define GEMM_IMPLEMENTATION
+#include "gemm.h"
+
+#define min(a, b) a > b ? b : a
+
+#define MAX_LEVELS 8
+
+// C = A * B pentru o matrice n x n; pentru nodurile interne, s, t si m sunt sumele si
+// produsele Strassen-Winograd, h x h (h = n / 2), luate din workspace
+typedef struct {
+	int n;
+	const int *a;
+	int lda;
+	const int *b;
+	int ldb;
+	int *c;
+	int ldc;
+	int *s[4];
+	int *t[4];
+	int *m[7];
+} Node;
+
+int N;
+int P;
+int cutoff = 512;
+int **a;
+int **b;
+int **c;
+
+// matricele sunt contigue, aliniate si completate cu zerouri pana la latura Np
+int Np;
+int leaf;
+int *A;
+int *B;
+int *C;
+
+// nivelurile 0 .. depth - 1 sunt calculate in paralel; nivelul depth contine frunzele,
+// 7^depth inmultiri independente pe care thread-urile le iau pe rand
+int depth;
+Node *levels[MAX_LEVELS + 1];
+int num_nodes[MAX_LEVELS + 1];
+int next_leaf;
+
+// workspace-ul: un singur bloc, impartit la pornire
+int *pool;
+size_t pool_size;
+size_t pool_used;
+int **workspace;
+
+gemm_plan *plans;
+pthread_barrier_t barrier;
+
+void get_args(int argc, char **argv)
+{
+	if(argc < 2) {
+		printf("Numar insuficient de parametri: ./program N [P] [cutoff]\n");
+		exit(1);
+	}
+
+	N = atoi(argv[1]);
+	P = argc > 2 ? atoi(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+	if (argc > 3) {
+		cutoff = atoi(argv[3]);
+	}
+
+	if (P < 1 || cutoff < 1) {
+		printf("P si cutoff trebuie sa fie pozitive\n");
+		exit(1);
+	}
+}
+
+int *pool_take(size_t size)
+{
+	int *block = pool + pool_used;
+
+	// blocurile raman aliniate la 64 de octeti
+	pool_used += (size + 15) / 16 * 16;
+	if (pool_used > pool_size) {
+		printf("Workspace prea mic\n");
+		exit(1);
+	}
+	return block;
+}
+
+// workspace-ul necesar lui strassen_seq() pentru un produs n x n
+size_t seq_workspace(int n)
+{
+	if (n <= leaf) {
+		return 0;
+	}
+
+	size_t h = n / 2;
+	return 15 * ((h * h + 15) / 16 * 16) + seq_workspace(h);
+}
+
+// aseaza la `ws` cele 15 matrici temporare h x h ale unui nod intern
+void split(Node *node, int *ws)
+{
+	size_t size = ((size_t)node->n / 2 * (node->n / 2) + 15) / 16 * 16;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		node->s[i] = ws + i * size;
+		node->t[i] = ws + (4 + i) * size;
+	}
+	for (i = 0; i < 7; i++) {
+		node->m[i] = ws + (8 + i) * size;
+	}
+}
+
+// operanzii produsului m[i] al nodului `node`:
+// m1 = A11 B11, m2 = A12 B21, m3 = S4 B22, m4 = A22 T4, m5 = S1 T1, m6 = S2 T2, m7 = S3 T3
+void child(const Node *node, int i, Node *out)
+{
+	int h = node->n / 2;
+	const int *a11 = node->a, *a12 = a11 + h;
+	const int *a22 = a11 + (size_t)h * node->lda + h;
+	const int *b11 = node->b, *b21 = b11 + (size_t)h * node->ldb;
+	const int *b22 = b21 + h;
+
+	const int *as[7] = { a11, a12, node->s[3], a22, node->s[0], node->s[1], node->s[2] };
+	const int *bs[7] = { b11, b21, b22, node->t[3], node->t[0], node->t[1], node->t[2] };
+	int ldas[7] = { node->lda, node->lda, h, node->lda, h, h, h };
+	int ldbs[7] = { node->ldb, node->ldb, node->ldb, h, h, h, h };
+
+	out->n = h;
+	out->a = as[i];
+	out->lda = ldas[i];
+	out->b = bs[i];
+	out->ldb = ldbs[i];
+	out->c = node->m[i];
+	out->ldc = h;
+}
+
+// S1 = A21 + A22, S2 = S1 - A11, S3 = A11 - A21, S4 = A12 - S2,
+// T1 = B12 - B11, T2 = B22 - T1, T3 = B22 - B12, T4 = T2 - B21, pe liniile [start, end)
+void pre_add(const Node *node, int start, int end)
+{
+	int h = node->n / 2;
+
+	for (int i = start; i < end; i++) {
+		const int *a11 = node->a + (size_t)i * node->lda, *a12 = a11 + h;
+		const int *a21 = a11 + (size_t)h * node->lda, *a22 = a21 + h;
+		const int *b11 = node->b + (size_t)i * node->ldb, *b12 = b11 + h;
+		const int *b21 = b11 + (size_t)h * node->ldb, *b22 = b21 + h;
+		int *s1 = node->s[0] + (size_t)i * h, *s2 = node->s[1] + (size_t)i * h;
+		int *s3 = node->s[2] + (size_t)i * h, *s4 = node->s[3] + (size_t)i * h;
+		int *t1 = node->t[0] + (size_t)i * h, *t2 = node->t[1] + (size_t)i * h;
+		int *t3 = node->t[2] + (size_t)i * h, *t4 = node->t[3] + (size_t)i * h;
+
+		for (int j = 0; j < h; j++) {
+			s1[j] = a21[j] + a22[j];
+			s2[j] = s1[j] - a11[j];
+			s3[j] = a11[j] - a21[j];
+			s4[j] = a12[j] - s2[j];
+
+			t1[j] = b12[j] - b11[j];
+			t2[j] = b22[j] - t1[j];
+			t3[j] = b22[j] - b12[j];
+			t4[j] = t2[j] - b21[j];
+		}
+	}
+}
+
+// C11 = m1 + m2, C12 = m1 + m6 + m5 + m3, C21 = m1 + m6 + m7 - m4,
+// C22 = m1 + m6 + m7 + m5, pe liniile [start, end)
+void post_add(const Node *node, int start, int end)
+{
+	int h = node->n / 2;
+
+	for (int i = start; i < end; i++) {
+		int *c11 = node->c + (size_t)i * node->ldc, *c12 = c11 + h;
+		int *c21 = c11 + (size_t)h * node->ldc, *c22 = c21 + h;
+		const int *m[7];
+
+		for (int k = 0; k < 7; k++) {
+			m[k] = node->m[k] + (size_t)i * h;
+		}
+
+		for (int j = 0; j < h; j++) {
+			int u2 = m[0][j] + m[5][j];
+			int u3 = u2 + m[6][j];
+
+			c11[j] = m[0][j] + m[1][j];
+			c12[j] = u2 + m[4][j] + m[2][j];
+			c21[j] = u3 - m[3][j];
+			c22[j] = u3 + m[4][j];
+		}
+	}
+}
+
+// Strassen-Winograd recursiv pe un singur thread, pana la GEMM-ul pe blocuri din frunze
+void strassen_seq(const Node *node, int *ws, gemm_plan *plan)
+{
+	if (node->n <= leaf) {
+		for (int i = 0; i < node->n; i++) {
+			memset(node->c + (size_t)i * node->ldc, 0, sizeof(int) * node->n);
+		}
+
+		gemm_set_operands(plan, node->n, node->n, node->n, node->a, node->lda,
+						  node->b, node->ldb, node->c, node->ldc);
+		gemm_thread(plan, 0);
+		return;
+	}
+
+	Node inner = *node;
+	size_t h = node->n / 2;
+
+	split(&inner, ws);
+	pre_add(&inner, 0, h);
+
+	for (int i = 0; i < 7; i++) {
+		Node sub;
+
+		child(&inner, i, &sub);
+		strassen_seq(&sub, ws + 15 * ((h * h + 15) / 16 * 16), plan);
+	}
+
+	post_add(&inner, 0, h);
+}
+
+void *thread_function(void *arg)
+{
+	int thread_id = *(int *)arg;
+	int l, i;
+
+	trace_thread("thread", thread_id);
+
+	// sumele nivelurilor paralele, de sus in jos; fiecare thread face o banda de linii
+	trace_begin("pre_add");
+	for (l = 0; l < depth; l++) {
+		for (i = 0; i < num_nodes[l]; i++) {
+			int h = levels[l][i].n / 2;
+			int start = thread_id * (double)h / P;
+			int end = min((thread_id + 1) * (double)h / P, h);
+
+			pre_add(&levels[l][i], start, end);
+		}
+		pthread_barrier_wait(&barrier);
+	}
+	trace_end("pre_add");
+
+	// frunzele sunt luate dinamic, cu workspace-ul si planul GEMM ale thread-ului
+	trace_begin("products");
+	while ((i = __atomic_fetch_add(&next_leaf, 1, __ATOMIC_RELAXED)) < num_nodes[depth]) {
+		strassen_seq(&levels[depth][i], workspace[thread_id], &plans[thread_id]);
+	}
+	pthread_barrier_wait(&barrier);
+	trace_end("products");
+
+	// produsele se combina de jos in sus
+	trace_begin("post_add");
+	for (l = depth - 1; l >= 0; l--) {
+		for (i = 0; i < num_nodes[l]; i++) {
+			int h = levels[l][i].n / 2;
+			int start = thread_id * (double)h / P;
+			int end = min((thread_id + 1) * (double)h / P, h);
+
+			post_add(&levels[l][i], start, end);
+		}
+		pthread_barrier_wait(&barrier);
+	}
+	trace_end("post_add");
+
+	pthread_exit(NULL);
+}
+
+void init()
+{
+	int i, j, l;
+
+	// Np = leaf * 2^L, cu leaf <= cutoff: fiecare nivel are latura para
+	int levels_total = 0;
+
+	leaf = N;
+	while (leaf > cutoff && levels_total < MAX_LEVELS) {
+		levels_total++;
+		leaf = (N + (1 << levels_total) - 1) >> levels_total;
+	}
+	Np = leaf << levels_total;
+
+	// destule frunze ca thread-urile sa fie ocupate pana la final
+	depth = 0;
+	for (int tasks = 1; P > 1 && depth < levels_total && tasks < 4 * P; tasks *= 7) {
+		depth++;
+	}
+
+	A = gemm_alloc(Np, Np);
+	B = gemm_alloc(Np, Np);
+	C = gemm_alloc(Np, Np);
+
+	a = gemm_rows(A, N, Np);
+	b = gemm_rows(B, N, Np);
+	c = gemm_rows(C, N, Np);
+
+	for (i = 0; i < N; i++) {
+		for (j = 0; j < N; j++) {
+			if (i <= j) {
+				a[i][j] = 1;
+				b[i][j] = 1;
+			}
+		}
+	}
+
+	// O(N^2) in total: 15 blocuri de (n / 2)^2 pentru fiecare nod intern si workspace-ul
+	// secvential al fiecarui thread
+	pool_size = 0;
+	for (l = 0, num_nodes[0] = 1; l < depth; l++) {
+		size_t h = (size_t)(Np >> l) / 2;
+
+		pool_size += num_nodes[l] * 15 * ((h * h + 15) / 16 * 16);
+		num_nodes[l + 1] = num_nodes[l] * 7;
+	}
+	pool_size += P * seq_workspace(Np >> depth);
+
+	if (posix_memalign((void **)&pool, 64, sizeof(int) * (pool_size ? pool_size : 16))) {
+		printf("Eroare la malloc!");
+		exit(1);
+	}
+	pool_used = 0;
+
+	for (l = 0; l <= depth; l++) {
+		levels[l] = malloc(sizeof(Node) * num_nodes[l]);
+		if (levels[l] == NULL) {
+			printf("Eroare la malloc!");
+			exit(1);
+		}
+	}
+
+	levels[0][0] = (Node){ .n = Np, .a = A, .lda = Np, .b = B, .ldb = Np, .c = C, .ldc = Np };
+	for (l = 0; l < depth; l++) {
+		size_t h = (size_t)(Np >> l) / 2;
+
+		for (i = 0; i < num_nodes[l]; i++) {
+			split(&levels[l][i], pool_take(15 * ((h * h + 15) / 16 * 16)));
+			for (j = 0; j < 7; j++) {
+				child(&levels[l][i], j, &levels[l + 1][7 * i + j]);
+			}
+		}
+	}
+
+	workspace = malloc(sizeof(int *) * P);
+	plans = malloc(sizeof(gemm_plan) * P);
+	if (workspace == NULL || plans == NULL) {
+		printf("Eroare la malloc!");
+		exit(1);
+	}
+
+	for (i = 0; i < P; i++) {
+		workspace[i] = pool_take(seq_workspace(Np >> depth));
+		gemm_init(&plans[i], 0, 0, 0, A, Np, B, Np, C, Np, 1, NULL);
+	}
+
+	next_leaf = 0;
+	pthread_barrier_init(&barrier, NULL, P);
+}
+
+void print(int **mat)
+{
+	int i, j;
+	for (i = 0; i < N; i++) {
+		for(j = 0; j < N; j++) {
+			printf("%i\t", mat[i][j]);
+		}
+		printf("\n");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	get_args(argc, argv);
+	init();
+
+	trace_init(getenv("TRACE_FILE"));
+	trace_thread("main", 0);
+
+	pthread_t tid[P];
+	int thread_id[P];
+
+	for (i = 0; i < P; i++) {
+		thread_id[i] = i;
+		pthread_create(&tid[i], NULL, thread_function, &thread_id[i]);
+	}
+
+	for (i = 0; i < P; i++) {
+		pthread_join(tid[i], NULL);
+	}
+
+	print(c);
+
+	for (i = 0; i < P; i++) {
+		gemm_destroy(&plans[i]);
+	}
+	for (i = 0; i <= depth; i++) {
+		free(levels[i]);
+	}
+	pthread_barrier_destroy(&barrier);
+	free(pool);
+
+	return 0;
+}
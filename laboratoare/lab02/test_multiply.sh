@@ -27,13 +27,41 @@ then
     exit
 fi
 
+if [ ! -f "multiply_blocked" ]
+then
+    echo "Nu exista binarul multiply_blocked"
+    exit
+fi
+
+if [ ! -f "multiply_recursive" ]
+then
+    echo "Nu exista binarul multiply_recursive"
+    exit
+fi
+
 ./multiply_seq $N > seq.txt
 ./multiply_outer $N $P > par_outer.txt
 ./multiply_middle $N $P > par_middle.txt
 ./multiply_inner $N $P > par_inner.txt
+./multiply_inner $N $P --ksplit > par_ksplit.txt
+./multiply_blocked $N $P > par_blocked.txt 2> /dev/null
+./multiply_recursive $N $P > par_recursive.txt 2> /dev/null
 
 diff seq.txt par_outer.txt
 diff seq.txt par_middle.txt
 diff seq.txt par_inner.txt
+diff seq.txt par_ksplit.txt
+diff seq.txt par_blocked.txt
+diff seq.txt par_recursive.txt
+
+# fiecare micro-kernel suportat de procesor
+for kernel in scalar sse4.1 avx2 avx512
+do
+    GEMM_KERNEL=$kernel ./multiply_blocked 1 1 > /dev/null 2>&1 || continue
+    GEMM_KERNEL=$kernel ./multiply_blocked $N $P > par_blocked.txt 2> /dev/null
+    diff seq.txt par_blocked.txt
+    GEMM_KERNEL=$kernel ./multiply_blocked $N $P --no-trmm > par_blocked.txt 2> /dev/null
+    diff seq.txt par_blocked.txt
+done
 
-rm -rf seq.txt par_outer.txt par_middle.txt par_inner.txt
\ No newline at end of file
+rm -rf seq.txt par_outer.txt par_middle.txt par_inner.txt par_ksplit.txt par_blocked.txt par_recursive.txt
\ No newline at end of file
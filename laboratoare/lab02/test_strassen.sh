@@ -20,4 +20,12 @@ fi
 
 diff seq.txt par.txt
 
+# N impar si cutoff mic: mai multe niveluri de recursie, cu padding
+if [ -f "multiply_seq" ]
+then
+    ./multiply_seq 999 > seq.txt
+    ./strassen_par 999 4 64 > par.txt
+    diff seq.txt par.txt
+fi
+
 rm -rf seq.txt par.txt
\ No newline at end of file
@@ -0,0 +1 @@
+../../parallel-contour-curve-drawing-marching-squares/src/trace.h
\ No newline at end of file
@@ -3,6 +3,9 @@
 #include <pthread.h>
 #include <math.h>
 
+#define TRACE_IMPLEMENTATION
+#include "trace.h"
+
 #define swap(a, b) a ^= b ^= a ^= b
 #define min(a, b) a > b ? b : a
 
@@ -84,6 +87,8 @@ void *thread_function(void *arg)
 {
 	int thread_id = *(int *)arg;
 
+	trace_thread("thread", thread_id);
+
 	int start = thread_id * (double)N / P;
 	int end = min((thread_id + 1) * (double)N / P, N - 1);
 
@@ -94,21 +99,29 @@ void *thread_function(void *arg)
 	}
 
 	for (int k = 0; k < N; k++) {
+		trace_begin("even phase");
 		for (int i = even_start; i < end; i += 2) {
 			if (v[i] > v[i + 1]) {
 				swap(v[i], v[i + 1]);
 			}
 		}
+		trace_end("even phase");
 
+		trace_begin("barrier");
 		pthread_barrier_wait(&barrier);
+		trace_end("barrier");
 
+		trace_begin("odd phase");
 		for (int i = odd_start; i < end; i += 2) {
 			if (v[i] > v[i + 1]) {
 				swap(v[i], v[i + 1]);
 			}
 		}
+		trace_end("odd phase");
 
+		trace_begin("barrier");
 		pthread_barrier_wait(&barrier);
+		trace_end("barrier");
 	}
 
 	pthread_exit(NULL);
@@ -119,6 +132,8 @@ int main(int argc, char *argv[])
 	get_args(argc, argv);
 	init();
 
+	trace_init(getenv("TRACE_FILE"));
+
 	int i, aux;
 	pthread_t tid[P];
 	int thread_id[P];
@@ -0,0 +1,105 @@
+#!/bin/bash
+
+# testeaza tema1_cubes pe o stiva de felii cu zgomot (multe fete ambigue), a carei
+# regiune intunecata nu atinge marginile volumului: mesh-ul trebuie sa fie inchis
+# (fiecare muchie are exact 2 triunghiuri), fara fete duplicate, si acelasi pentru
+# orice numar de thread-uri
+
+DIR=$(mktemp -d)
+failed=0
+
+function fail {
+    echo "W: $1"
+    failed=1
+}
+
+cd ../src
+make cubes &> /dev/null
+if [ ! -f tema1_cubes ]
+then
+    echo "E: Nu s-a putut compila tema1_cubes"
+    exit 1
+fi
+cd ../checker
+
+# genereaza feliile (parametri: latime inaltime numar_felii seed); punctele de pe
+# marginile volumului sunt albe, deci in afara suprafetei
+function make_slices {
+    for ((z = 0; z < $3; z++))
+    do
+        awk -v w=$1 -v h=$2 -v z=$z -v n=$3 -v seed=$(($4 * 1000 + z)) 'BEGIN {
+            srand(seed)
+            print "P2"; print w, h; print 255
+            for (y = 0; y < h; y++) {
+                line = ""
+                for (x = 0; x < w; x++) {
+                    border = x == 0 || y == 0 || x == w - 1 || y == h - 1 || z == 0 || z == n - 1
+                    line = line (border ? 255 : int(rand() * 256)) " "
+                }
+                print line
+            }
+        }' > $DIR/slice_$4_$(printf "%03d" $z).pgm
+    done
+}
+
+# verifica un fisier PLY binar scris de tema1_cubes: fete triunghiulare cu indici
+# valizi, fara fete duplicate (cu aceleasi varfuri, in orice ordine) si cu exact 2
+# triunghiuri pe fiecare muchie
+function check_mesh {
+    header=$(grep -a -m1 -b "^end_header" $1 | cut -d: -f1)
+    header=$((header + 11))
+    vertices=$(head -c $header $1 | awk '/^element vertex/ { print $3 }')
+    faces=$(head -c $header $1 | awk '/^element face/ { print $3 }')
+
+    tail -c +$((header + 12 * vertices + 1)) $1 | od -An -v -t u1 -w13 | awk -v nv=$vertices -v nf=$faces '
+        function int32(i) { return $(i) + 256 * ($(i + 1) + 256 * ($(i + 2) + 256 * $(i + 3))) }
+        function edge(a, b) { edges[a < b ? a " " b : b " " a]++ }
+        NF == 13 {
+            count++
+            a = int32(2); b = int32(6); c = int32(10)
+            if ($1 != 3 || a >= nv || b >= nv || c >= nv || a == b || b == c || a == c) {
+                bad++
+                next
+            }
+            # cheia fetei: varfurile sortate
+            if (a > b) { t = a; a = b; b = t }
+            if (b > c) { t = b; b = c; c = t }
+            if (a > b) { t = a; a = b; b = t }
+            if (seen[a " " b " " c]++) {
+                duplicates++
+            }
+            edge(a, b); edge(b, c); edge(a, c)
+        }
+        END {
+            for (e in edges) {
+                if (edges[e] != 2) {
+                    open++
+                }
+            }
+            printf "%d fete, %d varfuri, %d fete invalide, %d fete duplicate, %d muchii cu alt numar de triunghiuri decat 2\n",
+                count, nv, bad, duplicates, open
+            exit !(count == nf && count > 0 && !bad && !duplicates && !open)
+        }'
+}
+
+for seed in 1 2
+do
+    make_slices 120 90 12 $seed
+    pattern=$DIR/slice_${seed}_%03d.pgm
+
+    ../src/tema1_cubes $pattern 12 $DIR/ref.ply 1 || fail "tema1_cubes a esuat (seed $seed)"
+    check_mesh $DIR/ref.ply || fail "Mesh-ul nu este inchis sau are fete duplicate (seed $seed)"
+
+    for P in 2 3 5 11
+    do
+        ../src/tema1_cubes $pattern 12 $DIR/out.ply $P || fail "tema1_cubes a esuat (seed $seed, P = $P)"
+        cmp -s $DIR/out.ply $DIR/ref.ply || fail "Mesh-ul difera pentru P = $P (seed $seed)"
+    done
+done
+
+rm -rf $DIR
+if [ $failed == 0 ]
+then
+    echo "Toate testele au trecut"
+fi
+exit $failed
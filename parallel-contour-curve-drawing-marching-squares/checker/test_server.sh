@@ -0,0 +1,98 @@
+#!/bin/bash
+
+# testeaza modul server al tema1_par: rezultatele trebuie sa fie identice cu cele
+# ale unei rulari directe, clientii inactivi nu trebuie sa blocheze workerii, iar
+# serverul trebuie sa se opreasca imediat la SIGINT
+
+P=2
+WORKERS=1
+SOCKET=/tmp/tema1_server_$$.sock
+DIR=$(mktemp -d)
+failed=0
+
+function fail {
+    echo "W: $1"
+    failed=1
+}
+
+cd ../src
+make build &> /dev/null
+if [ ! -f tema1_par ]
+then
+    echo "E: Nu s-a putut compila tema"
+    exit 1
+fi
+cd ../checker
+
+# imagini de intrare aleatoare, una mica si una care trebuie redimensionata
+for size in "640 480" "2100 900"
+do
+    set -- $size
+    { printf "P6\n$1 $2\n255\n"; head -c $(($1 * $2 * 3)) /dev/urandom; } > $DIR/in_$1.ppm
+    ../src/tema1_par $DIR/in_$1.ppm $DIR/ref_$1.ppm $P --no-profile
+done
+
+# o cale care nu este socket nu trebuie stearsa
+cp $DIR/in_640.ppm $DIR/keep.ppm
+../src/tema1_par --serve $DIR/keep.ppm $P $WORKERS &> /dev/null && fail "Serverul a pornit pe un fisier obisnuit"
+cmp -s $DIR/keep.ppm $DIR/in_640.ppm || fail "Serverul a sters sau modificat un fisier care nu este socket"
+
+../src/tema1_par --serve $SOCKET $P $WORKERS > $DIR/server.txt &
+server=$!
+for i in $(seq 50)
+do
+    [ -S $SOCKET ] && break
+    sleep 0.1
+done
+
+# cereri inline si prin memfd, mai multe pe aceeasi conexiune
+for mode in "" "--memfd"
+do
+    for size in 640 2100
+    do
+        ../src/tema1_par --client $SOCKET $DIR/in_$size.ppm $DIR/out.ppm $mode --repeat 3 \
+            || fail "Cererea $mode pentru in_$size.ppm a esuat"
+        diff -q $DIR/out.ppm $DIR/ref_$size.ppm > /dev/null \
+            || fail "Rezultatul $mode pentru in_$size.ppm difera de rularea directa"
+    done
+done
+
+# un client care asteapta intre cereri nu trebuie sa tina ocupat singurul worker
+../src/tema1_par --client $SOCKET $DIR/in_640.ppm $DIR/idle.ppm --repeat 2 --idle 3000 &
+idle=$!
+sleep 0.5
+start=$(date +%s%N)
+../src/tema1_par --client $SOCKET $DIR/in_640.ppm $DIR/busy.ppm || fail "Cererea concurenta a esuat"
+elapsed=$((($(date +%s%N) - start) / 1000000))
+if [ $elapsed -gt 2000 ]
+then
+    fail "Cererea concurenta a asteptat ${elapsed} ms dupa clientul inactiv"
+fi
+wait $idle || fail "Clientul inactiv a esuat"
+diff -q $DIR/idle.ppm $DIR/ref_640.ppm > /dev/null || fail "Rezultatul clientului inactiv difera"
+
+../src/tema1_par --client $SOCKET --stats | grep -q "^requests " || fail "Cererea de statistici a esuat"
+
+# o conexiune inactiva nu trebuie sa amane oprirea serverului
+../src/tema1_par --client $SOCKET $DIR/in_640.ppm $DIR/idle.ppm --repeat 2 --idle 10000 2> /dev/null &
+idle=$!
+sleep 0.5
+kill -INT $server
+for i in $(seq 30)
+do
+    kill -0 $server 2> /dev/null || break
+    sleep 0.1
+done
+if kill -0 $server 2> /dev/null
+then
+    fail "Serverul nu s-a oprit la SIGINT"
+    kill -9 $server
+fi
+wait $idle 2> /dev/null
+
+rm -rf $DIR $SOCKET
+if [ $failed == 0 ]
+then
+    echo "Toate testele au trecut"
+fi
+exit $failed
@@ -0,0 +1,276 @@
+// Autotuning of the marching squares pipeline on the current host
+//
+// Every size class is tuned on a synthetic image of its largest size, by coordinate
+// descent: the thread count first, with the default settings, then the layout of the
+// rescale source and the side of the rescale tiles. A setting only replaces the current
+// one when its slowest typical run beats the fastest typical run of the current one, so
+// settings within the noise of each other keep the simpler choice.
+
+#include "autotune.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#define TRIAL_WARMUP            1
+#define TRIAL_REPS              5
+
+// Median and quartiles of the times of a trial, in milliseconds
+typedef struct {
+	double median_ms;
+	double low_ms, high_ms;
+} trial_result;
+
+static const int class_sizes[MS_TUNING_CLASSES] = { 1024, 2048, 4096, 8192 };
+static const int tile_sizes[] = { 32, 64, 128, 256 };
+static const char *layout_names[] = { "packed", "rgbx", "planar" };
+
+const char *ms_layout_name(ms_layout layout) {
+	return layout_names[layout];
+}
+
+int ms_layout_parse(const char *name) {
+	for (int i = 0; i < 3; i++) {
+		if (!strcmp(name, layout_names[i])) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Generates a `size` x `size` image with a pattern of dark blobs, as in the benchmark
+static ppm_image *generate_image(int size) {
+	ppm_image *image = (ppm_image *)malloc(sizeof(ppm_image));
+	if (!image) {
+		return NULL;
+	}
+
+	image->x = size;
+	image->y = size;
+	image->data = (ppm_pixel *)malloc((size_t)size * size * sizeof(ppm_pixel));
+	if (!image->data) {
+		free(image);
+		return NULL;
+	}
+
+	float f = 2.0f * (float)M_PI * 32 / size;
+	for (int i = 0; i < size; i++) {
+		float row = sinf(i * f);
+
+		for (int j = 0; j < size; j++) {
+			unsigned char value = (unsigned char)(160.0f + 95.0f * row * sinf(j * f + 0.5f * row));
+			ppm_pixel *pixel = &image->data[(size_t)i * size + j];
+
+			pixel->red = value;
+			pixel->green = value;
+			pixel->blue = value;
+		}
+	}
+
+	return image;
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// Times ms_process() on `image` with the settings of `tuning`. Returns 0 on success.
+static int trial(ppm_image *image, ppm_image *out, const ms_tuning *tuning,
+				 const char *contours_dir, trial_result *result) {
+	double samples[TRIAL_REPS];
+
+	ms_context *ctx = ms_create(tuning->num_threads, contours_dir);
+	if (!ctx) {
+		return -1;
+	}
+	ms_set_tile_size(ctx, tuning->tile_size);
+	ms_set_layout(ctx, tuning->layout);
+
+	for (int r = 0; r < TRIAL_WARMUP + TRIAL_REPS; r++) {
+		int64_t start = ms_now_ns();
+		if (ms_process(ctx, image->data, image->x, image->y, out)) {
+			ms_destroy(ctx);
+			return -1;
+		}
+
+		if (r >= TRIAL_WARMUP) {
+			samples[r - TRIAL_WARMUP] = (ms_now_ns() - start) / 1e6;
+		}
+	}
+
+	ms_destroy(ctx);
+
+	qsort(samples, TRIAL_REPS, sizeof(double), cmp_double);
+	result->median_ms = samples[TRIAL_REPS / 2];
+	result->low_ms = samples[TRIAL_REPS / 4];
+	result->high_ms = samples[TRIAL_REPS - 1 - TRIAL_REPS / 4];
+	return 0;
+}
+
+// Times `candidate` and makes it the best setting if its quartiles lie entirely below
+// those of `best`, whose trial is `best_result`
+static int try_candidate(ms_tuning *best, trial_result *best_result, ms_tuning *candidate,
+						 ppm_image *image, ppm_image *out, const char *contours_dir, FILE *log) {
+	trial_result result;
+	if (trial(image, out, candidate, contours_dir, &result)) {
+		return -1;
+	}
+
+	if (log) {
+		fprintf(log, "size %5d: threads %2d, layout %-6s, tile %3d -> %9.2f ms (%.2f - %.2f)\n",
+				candidate->max_size, candidate->num_threads, ms_layout_name(candidate->layout),
+				candidate->tile_size, result.median_ms, result.low_ms, result.high_ms);
+		fflush(log);
+	}
+
+	candidate->median_ms = result.median_ms;
+	if (best->median_ms < 0 || result.high_ms < best_result->low_ms) {
+		*best = *candidate;
+		*best_result = result;
+	}
+
+	return 0;
+}
+
+// Tunes the class of `size` x `size` images
+static int tune_class(ms_tuning *best, int size, int max_threads, const char *contours_dir,
+					  FILE *log) {
+	ppm_image *image = generate_image(size);
+	ppm_image out;
+
+	ms_output_size(size, size, &out.x, &out.y);
+	out.data = (ppm_pixel *)malloc((size_t)out.x * out.y * sizeof(ppm_pixel));
+	if (!image || !out.data) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	best->max_size = size;
+	best->num_threads = 1;
+	best->tile_size = 0;
+	best->layout = MS_LAYOUT_PACKED;
+	best->median_ms = -1;
+
+	int r = 0;
+	ms_tuning candidate = *best;
+	trial_result best_result;
+
+	// Powers of two below the maximum, then the maximum itself
+	for (int t = 1; !r; t = t * 2 < max_threads ? t * 2 : max_threads) {
+		candidate.num_threads = t;
+		r = try_candidate(best, &best_result, &candidate, image, &out, contours_dir, log);
+		if (t == max_threads) {
+			break;
+		}
+	}
+
+	// The layout and the tiles only matter for the images that are rescaled
+	if (out.x != size || out.y != size) {
+		for (int l = MS_LAYOUT_RGBX; l <= MS_LAYOUT_PLANAR && !r; l++) {
+			candidate = *best;
+			candidate.layout = (ms_layout)l;
+			r = try_candidate(best, &best_result, &candidate, image, &out, contours_dir, log);
+		}
+
+		for (size_t i = 0; i < sizeof(tile_sizes) / sizeof(tile_sizes[0]) && !r; i++) {
+			candidate = *best;
+			candidate.tile_size = tile_sizes[i];
+			r = try_candidate(best, &best_result, &candidate, image, &out, contours_dir, log);
+		}
+	}
+
+	free(out.data);
+	free(image->data);
+	free(image);
+
+	return r;
+}
+
+int ms_autotune(ms_profile *profile, int max_threads, const char *contours_dir, FILE *log) {
+	if (max_threads < 1) {
+		return -1;
+	}
+
+	// More threads than online processors only measure the noise of the scheduler
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > 0 && max_threads > cpus) {
+		max_threads = (int)cpus;
+	}
+
+	profile->count = 0;
+	for (int c = 0; c < MS_TUNING_CLASSES; c++) {
+		if (tune_class(&profile->classes[c], class_sizes[c], max_threads, contours_dir, log)) {
+			return -1;
+		}
+		profile->count++;
+	}
+
+	return 0;
+}
+
+int ms_profile_write(const ms_profile *profile, const char *filename) {
+	FILE *fp = fopen(filename, "w");
+	if (!fp) {
+		fprintf(stderr, "Unable to open file '%s'\n", filename);
+		return -1;
+	}
+
+	fprintf(fp, "# max_size threads tile_size layout median_ms\n");
+	for (int c = 0; c < profile->count; c++) {
+		const ms_tuning *t = &profile->classes[c];
+		fprintf(fp, "%d %d %d %s %.3f\n", t->max_size, t->num_threads, t->tile_size,
+				ms_layout_name(t->layout), t->median_ms);
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+int ms_profile_read(ms_profile *profile, const char *filename) {
+	char line[256], layout[16];
+
+	FILE *fp = fopen(filename, "r");
+	if (!fp) {
+		return -1;
+	}
+
+	profile->count = 0;
+	while (fgets(line, sizeof(line), fp) && profile->count < MS_TUNING_CLASSES) {
+		ms_tuning *t = &profile->classes[profile->count];
+
+		if (line[0] == '#') {
+			continue;
+		}
+
+		if (sscanf(line, "%d %d %d %15s %lf", &t->max_size, &t->num_threads, &t->tile_size,
+				   layout, &t->median_ms) != 5 || t->num_threads < 1 || t->tile_size < 0 ||
+			ms_layout_parse(layout) < 0) {
+			fclose(fp);
+			return -1;
+		}
+
+		t->layout = (ms_layout)ms_layout_parse(layout);
+		profile->count++;
+	}
+
+	fclose(fp);
+	return profile->count ? 0 : -1;
+}
+
+const ms_tuning *ms_profile_lookup(const ms_profile *profile, int w, int h) {
+	int size = w > h ? w : h;
+
+	if (!profile->count) {
+		return NULL;
+	}
+
+	// Classes are written in increasing order of size
+	for (int c = 0; c < profile->count; c++) {
+		if (size <= profile->classes[c].max_size) {
+			return &profile->classes[c];
+		}
+	}
+
+	return &profile->classes[profile->count - 1];
+}
@@ -0,0 +1,43 @@
+// Autotuning of the marching squares pipeline on the current host
+
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "marching.h"
+#include <stdio.h>
+
+#define MS_PROFILE_FILE         "tema1_par.profile"
+#define MS_TUNING_CLASSES       4
+
+// Settings picked for the images whose larger side is at most `max_size` (the last
+// class also covers every larger image)
+typedef struct {
+    int max_size;
+    int num_threads;
+    int tile_size;                  // Side of the rescale tiles, 0 for the default
+    ms_layout layout;               // Layout of the rescale source (interpolation kernel)
+    double median_ms;               // Time of ms_process() with these settings
+} ms_tuning;
+
+typedef struct {
+    int count;
+    ms_tuning classes[MS_TUNING_CLASSES];
+} ms_profile;
+
+// Runs trials on synthetic images of every size class with up to `max_threads` threads
+// and fills `profile` with the fastest settings. Progress is written to `log`, if not
+// NULL. Returns 0 on success.
+int ms_autotune(ms_profile *profile, int max_threads, const char *contours_dir, FILE *log);
+
+// Profiles are text files with one line per size class. Both return 0 on success.
+int ms_profile_write(const ms_profile *profile, const char *filename);
+int ms_profile_read(ms_profile *profile, const char *filename);
+
+// Settings of the size class of a `w` x `h` image, NULL for an empty profile
+const ms_tuning *ms_profile_lookup(const ms_profile *profile, int w, int h);
+
+// Name of a layout in the profiles and on the command line, and its inverse (-1 if unknown)
+const char *ms_layout_name(ms_layout layout);
+int ms_layout_parse(const char *name);
+
+#endif
@@ -0,0 +1,414 @@
+// In-process benchmark for libmarching on synthetic images
+
+#include "helpers.h"
+#include "marching.h"
+#include "timing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MAX_VALUES              16
+#define BENCH_STAGES            4
+
+// Sequential implementation from checker/tema1.c, linked in as the reference
+ppm_image **init_contour_map();
+ppm_image *rescale_image(ppm_image *image);
+unsigned char **sample_grid(ppm_image *image, int step_x, int step_y, unsigned char sigma);
+void march(ppm_image *image, unsigned char **grid, ppm_image **contour_map, int step_x, int step_y);
+
+// Stages reported by the benchmark; the last one is the whole ms_process() call
+static const char *bench_stage_names[BENCH_STAGES] = {
+	"rescale_image", "sample_grid", "march", "total"
+};
+static const ms_stage bench_stages[BENCH_STAGES - 1] = {
+	STAGE_RESCALE, STAGE_GRID, STAGE_MARCH
+};
+
+typedef struct {
+	int sizes[MAX_VALUES], num_sizes;
+	int densities[MAX_VALUES], num_densities;
+	int threads[MAX_VALUES], num_threads;
+	int warmup;
+	int reps;
+	int verify;
+	int quadtree;
+	int mipmap;
+	ms_layout layout;
+	int tiling;
+	int counters;
+	const char *csv_file;
+} BenchConfig;
+
+// Median of a sample with a distribution-free 95% confidence interval, taken from
+// the order statistics around the median
+typedef struct {
+	double median, low, high;
+} Estimate;
+
+static int parse_list(const char *arg, int *values) {
+	int n = 0;
+	char *copy = strdup(arg);
+
+	for (char *tok = strtok(copy, ","); tok && n < MAX_VALUES; tok = strtok(NULL, ",")) {
+		values[n++] = atoi(tok);
+	}
+	free(copy);
+
+	return n;
+}
+
+static void get_args(int argc, char **argv, BenchConfig *config) {
+	config->num_sizes = parse_list("512,1024,2048,4096", config->sizes);
+	config->num_densities = parse_list("4,32,256", config->densities);
+	config->num_threads = parse_list("1,2,4", config->threads);
+	config->warmup = 1;
+	config->reps = 7;
+	config->verify = 1;
+	config->quadtree = 0;
+	config->mipmap = 0;
+	config->layout = MS_LAYOUT_PACKED;
+	config->tiling = 1;
+	config->counters = 0;
+	config->csv_file = "benchmark.csv";
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--sizes") && i + 1 < argc) {
+			config->num_sizes = parse_list(argv[++i], config->sizes);
+		} else if (!strcmp(argv[i], "--densities") && i + 1 < argc) {
+			config->num_densities = parse_list(argv[++i], config->densities);
+		} else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			config->num_threads = parse_list(argv[++i], config->threads);
+		} else if (!strcmp(argv[i], "--warmup") && i + 1 < argc) {
+			config->warmup = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--reps") && i + 1 < argc) {
+			config->reps = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--csv") && i + 1 < argc) {
+			config->csv_file = argv[++i];
+		} else if (!strcmp(argv[i], "--no-verify")) {
+			config->verify = 0;
+		} else if (!strcmp(argv[i], "--quadtree")) {
+			config->quadtree = 1;
+		} else if (!strcmp(argv[i], "--mipmap")) {
+			config->mipmap = 1;
+		} else if (!strcmp(argv[i], "--layout") && i + 1 < argc) {
+			i++;
+			if (!strcmp(argv[i], "rgbx")) {
+				config->layout = MS_LAYOUT_RGBX;
+			} else if (!strcmp(argv[i], "planar")) {
+				config->layout = MS_LAYOUT_PLANAR;
+			} else if (!strcmp(argv[i], "packed")) {
+				config->layout = MS_LAYOUT_PACKED;
+			} else {
+				fprintf(stderr, "Unknown layout '%s'\n", argv[i]);
+				exit(1);
+			}
+		} else if (!strcmp(argv[i], "--no-tiling")) {
+			config->tiling = 0;
+		} else if (!strcmp(argv[i], "--counters")) {
+			config->counters = 1;
+		} else {
+			fprintf(stderr, "Usage: ./benchmark [--sizes 512,...,16384] [--densities 4,32,256] "
+					"[--threads 1,2,4] [--warmup W] [--reps R] [--csv <file>] [--no-verify] [--quadtree] [--mipmap] [--layout packed|rgbx|planar] [--no-tiling] [--counters]\n");
+			exit(1);
+		}
+	}
+
+	// The mipmap changes the output of the large images
+	if (config->mipmap) {
+		config->verify = 0;
+	}
+
+	if (config->reps < 1 || !config->num_sizes || !config->num_densities || !config->num_threads) {
+		fprintf(stderr, "Invalid benchmark configuration\n");
+		exit(1);
+	}
+}
+
+// Generates a `size` x `size` image whose dark regions form a pattern of blobs; `density`
+// is the number of blobs along each side, so the contour length grows linearly with it
+static ppm_image *generate_image(int size, int density) {
+	ppm_image *image = (ppm_image *)malloc(sizeof(ppm_image));
+	if (!image) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	image->x = size;
+	image->y = size;
+	image->data = (ppm_pixel *)malloc((size_t)size * size * sizeof(ppm_pixel));
+	if (!image->data) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	float f = 2.0f * (float)M_PI * density / size;
+	for (int i = 0; i < size; i++) {
+		float row = sinf(i * f);
+
+		for (int j = 0; j < size; j++) {
+			float value = 160.0f + 95.0f * row * sinf(j * f + 0.5f * row);
+			ppm_pixel *pixel = &image->data[(size_t)i * size + j];
+
+			pixel->red = (unsigned char)value;
+			pixel->green = (unsigned char)(value * 0.9f);
+			pixel->blue = (unsigned char)fminf(255.0f, value * 1.1f);
+		}
+	}
+
+	return image;
+}
+
+// Runs the sequential algorithm of checker/tema1.c on a copy of `image`
+static ppm_image *reference_output(ppm_image *image, ppm_image **contour_map) {
+	ppm_image *copy = (ppm_image *)malloc(sizeof(ppm_image));
+	if (!copy) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	size_t size = (size_t)image->x * image->y * sizeof(ppm_pixel);
+	copy->x = image->x;
+	copy->y = image->y;
+	copy->data = (ppm_pixel *)malloc(size);
+	if (!copy->data) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	memcpy(copy->data, image->data, size);
+
+	// rescale_image() releases its input when it creates a new image
+	ppm_image *scaled_image = rescale_image(copy);
+	unsigned char **grid = sample_grid(scaled_image, STEP, STEP, SIGMA);
+	march(scaled_image, grid, contour_map, STEP, STEP);
+
+	for (int i = 0; i <= scaled_image->x / STEP; i++) {
+		free(grid[i]);
+	}
+	free(grid);
+
+	return scaled_image;
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double A = *(double *)a;
+	double B = *(double *)b;
+	return (A > B) - (A < B);
+}
+
+static Estimate estimate(double *samples, int n) {
+	Estimate e;
+
+	qsort(samples, n, sizeof(double), cmp_double);
+	e.median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+
+	// Ranks n/2 -+ 1.96 * sqrt(n) / 2, clamped to the sample
+	int delta = (int)ceil(1.96 * sqrt(n) / 2);
+	int low = (n - 1) / 2 - delta;
+	int high = n / 2 + delta;
+	e.low = samples[low < 0 ? 0 : low];
+	e.high = samples[high > n - 1 ? n - 1 : high];
+
+	return e;
+}
+
+// Wall-clock duration of a stage: from the first thread entering it to the last one leaving
+static double stage_ms(ms_timing *timing, ms_stage stage) {
+	int64_t start = 0, end = 0;
+
+	for (int i = 0; i < timing->num_threads; i++) {
+		ms_thread_timing *t = &timing->threads[i];
+		if (!start || t->start[stage] < start) {
+			start = t->start[stage];
+		}
+		if (t->end[stage] > end) {
+			end = t->end[stage];
+		}
+	}
+
+	return (end - start) / 1e6;
+}
+
+// Hardware counter `counter` of a stage, summed over the workers
+static double stage_counter(ms_timing *timing, ms_stage stage, ms_counter counter) {
+	int64_t total = 0;
+
+	for (int i = 0; i < timing->num_threads; i++) {
+		total += timing->threads[i].counters[stage][counter];
+	}
+
+	return total;
+}
+
+// Whether any worker could read its cache miss counters (see perf_event_paranoid)
+static int counters_available(ms_timing *timing) {
+	int mask = (1 << COUNTER_L1D_MISSES) | (1 << COUNTER_LLC_MISSES);
+
+	for (int i = 0; i < timing->num_threads; i++) {
+		for (int s = 0; s < STAGE_COUNT; s++) {
+			if (timing->threads[i].counter_mask[s] & mask) {
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	BenchConfig config;
+	get_args(argc, argv, &config);
+
+	FILE *csv = fopen(config.csv_file, "w");
+	if (!csv) {
+		fprintf(stderr, "Unable to open file '%s'\n", config.csv_file);
+		return 1;
+	}
+	fprintf(csv, "size,density,threads,stage,median_ms,ci_low_ms,ci_high_ms,speedup,efficiency,"
+			"l1d_misses,llc_misses\n");
+
+	ppm_image **contour_map = config.verify ? init_contour_map() : NULL;
+	// Cache misses of every stage, with --counters (the whole call is not counted)
+	double *samples[BENCH_STAGES];
+	double *l1d_samples[BENCH_STAGES - 1], *llc_samples[BENCH_STAGES - 1];
+	for (int s = 0; s < BENCH_STAGES; s++) {
+		samples[s] = (double *)malloc(config.reps * sizeof(double));
+	}
+	for (int s = 0; s < BENCH_STAGES - 1; s++) {
+		l1d_samples[s] = (double *)calloc(config.reps, sizeof(double));
+		llc_samples[s] = (double *)calloc(config.reps, sizeof(double));
+	}
+
+	int failures = 0;
+
+	for (int si = 0; si < config.num_sizes; si++) {
+		for (int di = 0; di < config.num_densities; di++) {
+			int size = config.sizes[si];
+			int density = config.densities[di];
+			ppm_image *image = generate_image(size, density);
+			ppm_image *expected = config.verify ? reference_output(image, contour_map) : NULL;
+
+			ppm_image out;
+			ms_output_size(size, size, &out.x, &out.y);
+			out.data = (ppm_pixel *)malloc((size_t)out.x * out.y * sizeof(ppm_pixel));
+			if (!out.data) {
+				fprintf(stderr, "Unable to allocate memory\n");
+				exit(1);
+			}
+
+			// Medians of the first thread count, used as the speedup baseline
+			double baseline[BENCH_STAGES];
+
+			for (int ti = 0; ti < config.num_threads; ti++) {
+				int num_threads = config.threads[ti];
+				ms_context *ctx = ms_create(num_threads, "./contours");
+				ms_timing *timing = ms_timing_create(num_threads);
+				if (!ctx || !timing) {
+					fprintf(stderr, "Unable to create the marching squares context\n");
+					exit(1);
+				}
+				ms_set_timing(ctx, timing);
+				ms_set_quadtree(ctx, config.quadtree);
+				ms_set_mipmap(ctx, config.mipmap);
+				ms_set_layout(ctx, config.layout);
+				ms_set_tiling(ctx, config.tiling);
+				if (config.counters) {
+					ms_timing_enable_counters(timing);
+				}
+
+				for (int r = 0; r < config.warmup; r++) {
+					ms_process(ctx, image->data, size, size, &out);
+				}
+
+				for (int r = 0; r < config.reps; r++) {
+					ms_timing_reset(timing);
+
+					int64_t start = ms_now_ns();
+					ms_process(ctx, image->data, size, size, &out);
+					samples[BENCH_STAGES - 1][r] = (ms_now_ns() - start) / 1e6;
+
+					for (int s = 0; s < BENCH_STAGES - 1; s++) {
+						samples[s][r] = stage_ms(timing, bench_stages[s]);
+						l1d_samples[s][r] = stage_counter(timing, bench_stages[s], COUNTER_L1D_MISSES);
+						llc_samples[s][r] = stage_counter(timing, bench_stages[s], COUNTER_LLC_MISSES);
+					}
+				}
+
+				if (config.counters && !counters_available(timing)) {
+					fprintf(stderr, "Hardware counters are not available (see perf_event_paranoid)\n");
+					config.counters = 0;
+				}
+
+				const char *status = "";
+				if (expected) {
+					size_t bytes = (size_t)out.x * out.y * sizeof(ppm_pixel);
+					int ok = out.x == expected->x && out.y == expected->y &&
+							 !memcmp(out.data, expected->data, bytes);
+					status = ok ? "  OK" : "  MISMATCH";
+					failures += !ok;
+				}
+
+				printf("size %5d density %3d threads %2d:", size, density, num_threads);
+				for (int s = 0; s < BENCH_STAGES; s++) {
+					Estimate e = estimate(samples[s], config.reps);
+					if (ti == 0) {
+						baseline[s] = e.median;
+					}
+
+					double speedup = e.median > 0 ? baseline[s] / e.median : 0;
+					double efficiency = speedup * config.threads[0] / num_threads;
+
+					double l1d = 0, llc = 0;
+					if (s < BENCH_STAGES - 1) {
+						l1d = estimate(l1d_samples[s], config.reps).median;
+						llc = estimate(llc_samples[s], config.reps).median;
+					}
+
+					printf("  %s %.2f ms [%.2f, %.2f]", bench_stage_names[s], e.median, e.low, e.high);
+					if (config.counters && s < BENCH_STAGES - 1) {
+						printf(" (L1D %.0f, LLC %.0f misses)", l1d, llc);
+					}
+					fprintf(csv, "%d,%d,%d,%s,%.4f,%.4f,%.4f,%.4f,%.4f,%.0f,%.0f\n", size, density,
+							num_threads, bench_stage_names[s], e.median, e.low, e.high, speedup,
+							efficiency, l1d, llc);
+				}
+				printf("%s\n", status);
+				fflush(stdout);
+
+				ms_timing_destroy(timing);
+				ms_destroy(ctx);
+			}
+
+			free(out.data);
+			if (expected) {
+				free(expected->data);
+				free(expected);
+			}
+			free(image->data);
+			free(image);
+		}
+	}
+
+	for (int s = 0; s < BENCH_STAGES; s++) {
+		free(samples[s]);
+	}
+	for (int s = 0; s < BENCH_STAGES - 1; s++) {
+		free(l1d_samples[s]);
+		free(llc_samples[s]);
+	}
+	if (contour_map) {
+		for (int i = 0; i < CONTOUR_CONFIG_COUNT; i++) {
+			free(contour_map[i]->data);
+			free(contour_map[i]);
+		}
+		free(contour_map);
+	}
+	fclose(csv);
+
+	if (failures) {
+		fprintf(stderr, "%d configurations differ from the sequential implementation\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,1298 @@
+// Author: APD team, except where source was noted
+
+#include "marching.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <math.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#define CLAMP(v, min, max) if(v < min) { v = min; } else if(v > max) { v = max; }
+
+// Find the minimum out of two numbers
+#define min(a, b) a < b ? a : b
+
+// Levels of the quadtree over the cells of the largest grid (256 x 256 cells)
+#define PYRAMID_LEVELS			9
+#define MIXED					255
+
+// Deepest level of the mipmap built before rescaling very large images
+#define MIPMAP_LEVELS			16
+
+// Bounds of the side of the rescale tiles, in output pixels
+#define MIN_TILE				16
+#define MAX_TILE				256
+
+// L2 size assumed when the host does not report it
+#define DEFAULT_L2_SIZE			(256 * 1024)
+
+// Columns of grid points sampled between two releases of the input in low-memory mode
+#define STREAM_BLOCK			16
+
+// Structure used to pass data to the thread function
+typedef struct {
+	int id;						// Thread identifier
+	int num_threads;			// Total number of threads
+	pthread_barrier_t* barrier; // Synchronization barrier for threads
+	ppm_image* image;			// Pointer to the original image
+	ppm_image* scaled_image;
+	ppm_image** contour_map;
+	unsigned char** grid;
+	int step_x;
+	int step_y;
+	ms_context* ctx;			// Context that owns the thread
+	ms_thread_timing* timing;	// Measurements of the thread, NULL when disabled
+	int64_t tile_pixels;		// Pixels rescaled by the thread in the current job
+} ThreadData;
+
+struct ms_context {
+	int num_threads;
+	pthread_t* threads;
+	ThreadData* thread_data;
+	pthread_barrier_t barrier;			// Synchronizes the stages of a job
+	pthread_barrier_t start_barrier;	// Releases the workers when a job is posted
+	pthread_barrier_t done_barrier;		// Signals the caller that the job is done
+	int shutdown;
+	ppm_image** contour_map;
+	unsigned char** grid;
+	ppm_image source;					// Input of the current job
+	ppm_image output;					// Output of the current job
+	ms_timing* timing;					// Instrumentation, NULL when disabled
+	ms_regions* regions;				// Labeled regions, NULL when disabled
+	int quadtree;						// Whether march() skips homogeneous blocks
+	unsigned char* pyramid[PYRAMID_LEVELS];	// Configuration of every block, MIXED if not uniform
+	int tile_uniform[CONTOUR_CONFIG_COUNT];	// Whether a contour tile has a single color
+	ppm_pixel tile_color[CONTOUR_CONFIG_COUNT];
+	int mipmap;							// Whether large images are box-filtered first
+	int mip_levels;						// Levels of the mipmap of the current job
+	ppm_image mip[MIPMAP_LEVELS];		// Level l + 1 is the 2x reduction of level l
+	ppm_pixel* mip_buffer[2];			// Levels alternate between the two buffers
+	size_t mip_capacity[2];
+	ms_layout layout;					// Layout of the source of the bicubic rescale
+	uint8_t* layout_buffer;				// Source converted to `layout`, 64-byte aligned
+	size_t layout_capacity;
+	unsigned char* luma;				// Luminance of the rescaled image, for sample_grid()
+	int use_layout;						// Whether the current job rescales from the buffer
+	const uint8_t* gray;				// Grayscale input of the current job, NULL for color
+	const unsigned char* grid_luma;		// Read by sample_grid() instead of the pixels, if set
+	int low_memory;						// Whether rescaled images are streamed into the grid
+	int stream;							// Whether the current job is streamed
+	uint8_t* input;						// Input of the current job, released while streaming
+	size_t input_row;					// Bytes of an input row
+	size_t input_size;
+	uintptr_t released;					// End of the input pages released so far
+	int tiling;							// Whether the rescale works on 2D tiles
+	int fixed_tile;						// Side of the tiles, 0 to size them for the L2 cache
+	int tile_size;						// Side of the tiles of the current job
+	int tile_rows, tile_cols;
+	int next_tile;						// Next tile to be claimed, shared by the threads
+};
+
+// Creates a map between the binary configuration (e.g. 0110_2) and the corresponding pixels
+// that need to be set on the output image. An array is used for this map since the keys are
+// binary numbers in 0-15. Contour images are located in the `contours_dir` directory.
+static ppm_image **init_contour_map(const char *contours_dir) {
+	ppm_image **map = (ppm_image **)malloc(CONTOUR_CONFIG_COUNT * sizeof(ppm_image *));
+	if (!map) {
+		return NULL;
+	}
+
+	for (int i = 0; i < CONTOUR_CONFIG_COUNT; i++) {
+		char filename[FILENAME_MAX_SIZE + 256];
+		snprintf(filename, sizeof(filename), "%s/%d.ppm", contours_dir, i);
+
+		// read_ppm() exits on a missing file, so check for it beforehand
+		if (access(filename, R_OK)) {
+			fprintf(stderr, "Unable to open file '%s'\n", filename);
+			for (int j = 0; j < i; j++) {
+				free(map[j]->data);
+				free(map[j]);
+			}
+			free(map);
+			return NULL;
+		}
+
+		map[i] = read_ppm(filename);
+	}
+
+	return map;
+}
+
+// Updates a particular section of an image with the corresponding contour pixels.
+// Used to create the complete contour image.
+static void update_image(ppm_image *image, ppm_image *contour, int x, int y) {
+	for (int i = 0; i < contour->x; i++) {
+		for (int j = 0; j < contour->y; j++) {
+			int contour_pixel_index = contour->x * i + j;
+			int image_pixel_index = (x + i) * image->y + y + j;
+
+			image->data[image_pixel_index].red = contour->data[contour_pixel_index].red;
+			image->data[image_pixel_index].green = contour->data[contour_pixel_index].green;
+			image->data[image_pixel_index].blue = contour->data[contour_pixel_index].blue;
+		}
+	}
+}
+
+// Gray level of the pixel at `index` of the rescaled image, which is read from the luminance
+// plane when the rescale produced one
+static inline unsigned char pixel_color(ThreadData* data, ppm_image *image, int index) {
+	if (data->ctx->grid_luma) {
+		return data->ctx->grid_luma[index];
+	}
+
+	ppm_pixel curr_pixel = image->data[index];
+	return (curr_pixel.red + curr_pixel.green + curr_pixel.blue) / 3;
+}
+
+// Corresponds to step 1 of the marching squares algorithm, which focuses on sampling the image.
+// Builds a p x q grid of points with values which can be either 0 or 1, depending on how the
+// pixel values compare to the `sigma` reference value. The points are taken at equal distances
+// in the original image, based on the `step_x` and `step_y` arguments.
+static unsigned char **sample_grid(unsigned char sigma, ThreadData* data) {
+	ppm_image *image = data->scaled_image;
+	int step_x = data->step_x;
+	int step_y = data->step_y;
+	int p = image->x / step_x;
+	int q = image->y / step_y;
+
+	// Compute the [start, end) section that the thread will work on
+	int start_i = data->id * (double)p / data->num_threads;
+	int end_i = min((data->id + 1) * (double)p / data->num_threads, p);
+
+	for (int i = start_i; i < end_i; i++) {
+		for (int j = 0; j < q; j++) {
+			unsigned char curr_color = pixel_color(data, image, i * step_x * image->y + j * step_y);
+
+			if (curr_color > sigma) {
+				data->grid[i][j] = 0;
+			} else {
+				data->grid[i][j] = 1;
+			}
+		}
+	}
+	data->grid[p][q] = 0;
+
+	// Last sample points have no neighbors below / to the right, so we use pixels on the
+	// last row / column of the input image for them
+	for (int i = start_i; i < end_i; i++) {
+		unsigned char curr_color = pixel_color(data, image, i * step_x * image->y + image->x - 1);
+
+		if (curr_color > sigma) {
+			data->grid[i][q] = 0;
+		} else {
+			data->grid[i][q] = 1;
+		}
+	}
+
+	// Compute the [start, end) section that the thread will work on
+	int start_j = data->id * (double)q / data->num_threads;
+	int end_j = min((data->id + 1) * (double)q / data->num_threads, q);
+
+	for (int j = start_j; j < end_j; j++) {
+		unsigned char curr_color = pixel_color(data, image, (image->x - 1) * image->y + j * step_y);
+
+		if (curr_color > sigma) {
+			data->grid[p][j] = 0;
+		} else {
+			data->grid[p][j] = 1;
+		}
+	}
+
+	return data->grid;
+}
+
+// Corresponds to step 2 of the marching squares algorithm, which focuses on identifying the
+// type of contour which corresponds to each subgrid. It determines the binary value of each
+// sample fragment of the original image and replaces the pixels in the original image with
+// the pixels of the corresponding contour image accordingly.
+static void march(ppm_image *image, unsigned char **grid, ppm_image **contour_map,
+		   ThreadData* data) {
+	int p = image->x / data->step_x;
+	int q = image->y / data->step_y;
+
+	// Compute the [start, end) section that the thread will work on
+	int start_i = data->id * (double)p / data->num_threads;
+	int end_i = min((data->id + 1) * (double)p / data->num_threads, p);
+
+	for (int i = start_i; i < end_i; i++) {
+		for (int j = 0; j < q; j++) {
+			unsigned char k = 8 * grid[i][j] + 4 * grid[i][j + 1] +
+							  2 * grid[i + 1][j + 1] + 1 * grid[i + 1][j];
+			update_image(image, contour_map[k], i * data->step_x, j * data->step_y);
+		}
+	}
+}
+
+// Halves `source` into `level` by averaging blocks of 2x2 pixels (the last row / column
+// is repeated for odd sizes). Every row of `source` is read once, in order.
+static void reduce_image(ppm_image *source, ppm_image *level, ThreadData* data) {
+	// Compute the [start, end) section that the thread will work on
+	int start_y = data->id * (double)level->y / data->num_threads;
+	int end_y = min((data->id + 1) * (double)level->y / data->num_threads, level->y);
+
+	for (int y = start_y; y < end_y; y++) {
+		ppm_pixel* row0 = &source->data[(size_t)2 * y * source->x];
+		ppm_pixel* row1 = 2 * y + 1 < source->y ? row0 + source->x : row0;
+
+		for (int x = 0; x < level->x; x++) {
+			int x0 = 2 * x, x1 = 2 * x + 1 < source->x ? 2 * x + 1 : 2 * x;
+			ppm_pixel* pixel = &level->data[(size_t)y * level->x + x];
+
+			pixel->red = (row0[x0].red + row0[x1].red + row1[x0].red + row1[x1].red + 2) / 4;
+			pixel->green = (row0[x0].green + row0[x1].green +
+							row1[x0].green + row1[x1].green + 2) / 4;
+			pixel->blue = (row0[x0].blue + row0[x1].blue + row1[x0].blue + row1[x1].blue + 2) / 4;
+		}
+	}
+}
+
+// Waits at the stage barrier, accounting the time spent there when instrumented
+static void barrier_wait(ThreadData* data) {
+	trace_begin("barrier");
+
+	if (!data->timing) {
+		pthread_barrier_wait(data->barrier);
+	} else {
+		int64_t start = ms_now_ns();
+		pthread_barrier_wait(data->barrier);
+		data->timing->barrier_wait += ms_now_ns() - start;
+		data->timing->barrier_count++;
+	}
+
+	trace_end("barrier");
+}
+
+// Claims the next part of the rescaled image for the thread: the [i0, i1) x [j0, j1)
+// pixels of the next tile, or, without tiling, the band of whole rows of the thread on
+// the first call. Returns 0 when there is nothing left.
+static int next_tile(ThreadData* data, int* claimed, int* i0, int* i1, int* j0, int* j1) {
+	ms_context* ctx = data->ctx;
+	ppm_image* image = data->scaled_image;
+
+	if (!ctx->tiling) {
+		if ((*claimed)++) {
+			return 0;
+		}
+
+		// Compute the [start, end) section that the thread will work on
+		*i0 = data->id * (double)image->x / data->num_threads;
+		*i1 = min((data->id + 1) * (double)image->x / data->num_threads, image->x);
+		*j0 = 0;
+		*j1 = image->y;
+	} else {
+		// Tiles are handed out in row-major order, so neighboring tiles share source rows
+		int t = __atomic_fetch_add(&ctx->next_tile, 1, __ATOMIC_RELAXED);
+		if (t >= ctx->tile_rows * ctx->tile_cols) {
+			return 0;
+		}
+
+		*i0 = t / ctx->tile_cols * ctx->tile_size;
+		*i1 = min(*i0 + ctx->tile_size, image->x);
+		*j0 = t % ctx->tile_cols * ctx->tile_size;
+		*j1 = min(*j0 + ctx->tile_size, image->y);
+	}
+
+	data->tile_pixels += (int64_t)(*i1 - *i0) * (*j1 - *j0);
+	return 1;
+}
+
+// Converts `source` to the layout of the context: 4-byte RGBX pixels, or one plane per
+// channel. Every thread converts a band of rows.
+static void convert_source(ppm_image *source, ThreadData* data) {
+	ms_context* ctx = data->ctx;
+	size_t plane = (size_t)source->x * source->y;
+
+	// Compute the [start, end) section that the thread will work on
+	int start_y = data->id * (double)source->y / data->num_threads;
+	int end_y = min((data->id + 1) * (double)source->y / data->num_threads, source->y);
+
+	size_t start = (size_t)start_y * source->x, end = (size_t)end_y * source->x;
+
+	if (ctx->layout == MS_LAYOUT_RGBX) {
+		for (size_t k = start; k < end; k++) {
+			uint8_t* rgbx = &ctx->layout_buffer[4 * k];
+			rgbx[0] = source->data[k].red;
+			rgbx[1] = source->data[k].green;
+			rgbx[2] = source->data[k].blue;
+			rgbx[3] = 0;
+		}
+	} else {
+		for (size_t k = start; k < end; k++) {
+			ctx->layout_buffer[k] = source->data[k].red;
+			ctx->layout_buffer[plane + k] = source->data[k].green;
+			ctx->layout_buffer[2 * plane + k] = source->data[k].blue;
+		}
+	}
+}
+
+// Four floats computed together with the GCC vector extensions (SSE on x86-64, even
+// without optimizations). Every lane goes through the same operations as in
+// cubic_hermite(), so the output does not depend on the layout.
+typedef float v4f __attribute__((vector_size(16)));
+typedef uint8_t v4u8 __attribute__((vector_size(4)));
+
+// Same as cubic_hermite(), on 4 lanes at once
+static inline v4f cubic_hermite4(v4f A, v4f B, v4f C, v4f D, float t) {
+	v4f a = -A / 2.0f + (3.0f * B) / 2.0f - (3.0f * C) / 2.0f + D / 2.0f;
+	v4f b = A - (5.0f * B) / 2.0f + 2.0f * C - D / 2.0f;
+	v4f c = -A / 2.0f + C / 2.0f;
+	v4f d = B;
+
+	return a * t * t * t + b * t * t + c * t + d;
+}
+
+// Loads an RGBX pixel as 4 floats
+static inline v4f load_rgbx(const uint8_t* rgbx) {
+	v4u8 bytes;
+	memcpy(&bytes, rgbx, sizeof(bytes));
+	return __builtin_convertvector(bytes, v4f);
+}
+
+// Same as sample_bicubic(), on RGBX pixels: each tap is a single 4-byte load, and the
+// channels are the lanes of the interpolation
+static void sample_bicubic_rgbx(const uint8_t* rgbx, int X, int Y, float u, float v,
+								uint8_t sample[]) {
+	float x = (u * X) - 0.5;
+	int xint = (int)x;
+	float xfract = x - floor(x);
+
+	float y = (v * Y) - 0.5;
+	int yint = (int)y;
+	float yfract = y - floor(y);
+
+	int xs[4];
+	for (int c = 0; c < 4; c++) {
+		xs[c] = xint - 1 + c;
+		CLAMP(xs[c], 0, X - 1);
+	}
+
+	v4f col[4];
+	for (int r = 0; r < 4; r++) {
+		int yy = yint - 1 + r;
+		CLAMP(yy, 0, Y - 1);
+		const uint8_t* row = &rgbx[4 * (size_t)X * yy];
+
+		// interpolate along the row
+		col[r] = cubic_hermite4(load_rgbx(row + 4 * xs[0]), load_rgbx(row + 4 * xs[1]),
+								load_rgbx(row + 4 * xs[2]), load_rgbx(row + 4 * xs[3]), xfract);
+	}
+
+	// interpolate along the column
+	v4f value = cubic_hermite4(col[0], col[1], col[2], col[3], yfract);
+
+	for (int i = 0; i < 3; i++) {
+		CLAMP(value[i], 0.0f, 255.0f);
+		sample[i] = (uint8_t)value[i];
+	}
+}
+
+// Same as sample_bicubic(), on one plane per channel: the 4 rows of taps are the lanes
+// of the interpolation along the rows, then the column is interpolated on its own
+static void sample_bicubic_planar(const uint8_t* planes, int X, int Y, float u, float v,
+								  uint8_t sample[]) {
+	float x = (u * X) - 0.5;
+	int xint = (int)x;
+	float xfract = x - floor(x);
+
+	float y = (v * Y) - 0.5;
+	int yint = (int)y;
+	float yfract = y - floor(y);
+
+	int xs[4];
+	for (int c = 0; c < 4; c++) {
+		xs[c] = xint - 1 + c;
+		CLAMP(xs[c], 0, X - 1);
+	}
+
+	size_t rows[4];
+	for (int r = 0; r < 4; r++) {
+		int yy = yint - 1 + r;
+		CLAMP(yy, 0, Y - 1);
+		rows[r] = (size_t)X * yy;
+	}
+
+	for (int i = 0; i < 3; i++) {
+		const uint8_t* plane = &planes[i * (size_t)X * Y];
+		v4f taps[4];
+
+		for (int c = 0; c < 4; c++) {
+			taps[c] = (v4f){ plane[rows[0] + xs[c]], plane[rows[1] + xs[c]],
+							 plane[rows[2] + xs[c]], plane[rows[3] + xs[c]] };
+		}
+
+		// interpolate along the rows, then along the column
+		v4f col = cubic_hermite4(taps[0], taps[1], taps[2], taps[3], xfract);
+		float value = cubic_hermite(col[0], col[1], col[2], col[3], yfract);
+
+		CLAMP(value, 0.0f, 255.0f);
+		sample[i] = (uint8_t)value;
+	}
+}
+
+// Rescales the tiles claimed by the thread with `sample_layout`, also storing the
+// luminance of every pixel. Inlined once per layout, so the kernel is known in the loop.
+static inline __attribute__((always_inline)) void rescale_tiles_layout(
+	ThreadData* data, ppm_image *source,
+	void (*sample_layout)(const uint8_t*, int, int, float, float, uint8_t[])) {
+	ppm_image* image = data->scaled_image;
+	const uint8_t* buffer = data->ctx->layout_buffer;
+	uint8_t sample[3];
+
+	int claimed = 0, i0, i1, j0, j1;
+	while (next_tile(data, &claimed, &i0, &i1, &j0, &j1)) {
+		for (int i = i0; i < i1; i++) {
+			for (int j = j0; j < j1; j++) {
+				float u = (float)i / (float)(image->x - 1);
+				float v = (float)j / (float)(image->y - 1);
+				sample_layout(buffer, source->x, source->y, u, v, sample);
+
+				ppm_pixel* pixel = &image->data[i * image->y + j];
+				pixel->red = sample[0];
+				pixel->green = sample[1];
+				pixel->blue = sample[2];
+				data->ctx->luma[i * image->y + j] = (sample[0] + sample[1] + sample[2]) / 3;
+			}
+		}
+	}
+}
+
+// Same as rescale_image(), from the converted source. The luminance of every pixel is
+// stored as well, so sample_grid() reads one byte per point.
+static ppm_image *rescale_image_layout(ThreadData* data, ppm_image *source) {
+	convert_source(source, data);
+	barrier_wait(data);
+
+	if (data->ctx->layout == MS_LAYOUT_RGBX) {
+		rescale_tiles_layout(data, source, sample_bicubic_rgbx);
+	} else {
+		rescale_tiles_layout(data, source, sample_bicubic_planar);
+	}
+
+	return data->scaled_image;
+}
+
+// Same as sample_bicubic(), on a single channel
+static uint8_t sample_bicubic_gray(const uint8_t* gray, int X, int Y, float u, float v) {
+	float x = (u * X) - 0.5;
+	int xint = (int)x;
+	float xfract = x - floor(x);
+
+	float y = (v * Y) - 0.5;
+	int yint = (int)y;
+	float yfract = y - floor(y);
+
+	int xs[4];
+	for (int c = 0; c < 4; c++) {
+		xs[c] = xint - 1 + c;
+		CLAMP(xs[c], 0, X - 1);
+	}
+
+	float col[4];
+	for (int r = 0; r < 4; r++) {
+		int yy = yint - 1 + r;
+		CLAMP(yy, 0, Y - 1);
+		const uint8_t* row = &gray[(size_t)X * yy];
+
+		col[r] = cubic_hermite(row[xs[0]], row[xs[1]], row[xs[2]], row[xs[3]], xfract);
+	}
+
+	float value = cubic_hermite(col[0], col[1], col[2], col[3], yfract);
+	CLAMP(value, 0.0f, 255.0f);
+
+	return (uint8_t)value;
+}
+
+// Rescale stage of a grayscale image. A gray pixel has the same value on the three
+// channels, so its luminance is the interpolated value itself and the grid is sampled
+// from it. Only the pixels that march() does not cover need to be written as RGB: none
+// for a rescaled image, the last rows and columns for an image that is not rescaled.
+static void rescale_gray(ThreadData* data) {
+	ms_context* ctx = data->ctx;
+	ppm_image* image = data->scaled_image;
+	int w = data->image->x, h = data->image->y;
+	int rescaled = image->x != w || image->y != h;
+
+	if (rescaled) {
+		int claimed = 0, i0, i1, j0, j1;
+		while (next_tile(data, &claimed, &i0, &i1, &j0, &j1)) {
+			for (int i = i0; i < i1; i++) {
+				for (int j = j0; j < j1; j++) {
+					float u = (float)i / (float)(image->x - 1);
+					float v = (float)j / (float)(image->y - 1);
+					ctx->luma[i * image->y + j] = sample_bicubic_gray(ctx->gray, w, h, u, v);
+				}
+			}
+		}
+		return;
+	}
+
+	// Compute the [start, end) section that the thread will work on
+	int start_i = data->id * (double)image->x / data->num_threads;
+	int end_i = min((data->id + 1) * (double)image->x / data->num_threads, image->x);
+
+	int covered_rows = image->x / data->step_x * data->step_x;
+	int covered_cols = image->y / data->step_y * data->step_y;
+
+	for (int i = start_i; i < end_i; i++) {
+		for (int j = i < covered_rows ? covered_cols : 0; j < image->y; j++) {
+			uint8_t value = ctx->gray[i * image->y + j];
+			ppm_pixel* pixel = &image->data[i * image->y + j];
+			pixel->red = value;
+			pixel->green = value;
+			pixel->blue = value;
+		}
+	}
+}
+
+// Rescale the original image to 2048x2048 using bicubic interpolation, sampling
+// `source`, which is either the original image or a level of its mipmap
+static ppm_image *rescale_image(ThreadData* data, ppm_image *source) {
+	uint8_t sample[3];
+
+	// We only rescale downwards
+	if (data->image->x <= RESCALE_X && data->image->y <= RESCALE_Y) {
+		return data->image;
+	}
+
+	// Use bicubic interpolation for scaling, one tile (or band of rows) at a time
+	int claimed = 0, i0, i1, j0, j1;
+	while (next_tile(data, &claimed, &i0, &i1, &j0, &j1)) {
+		for (int i = i0; i < i1; i++) {
+			for (int j = j0; j < j1; j++) {
+				float u = (float)i / (float)(data->scaled_image->x - 1);
+				float v = (float)j / (float)(data->scaled_image->y - 1);
+				sample_bicubic(source, u, v, sample);
+
+				data->scaled_image->data[i * data->scaled_image->y + j].red = sample[0];
+				data->scaled_image->data[i * data->scaled_image->y + j].green = sample[1];
+				data->scaled_image->data[i * data->scaled_image->y + j].blue = sample[2];
+			}
+		}
+	}
+
+	return data->scaled_image;
+}
+
+// Returns the pages of the first `rows` input rows to the system; the pages that also
+// hold the next row are kept
+static void release_input(ms_context* ctx, size_t rows) {
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	size_t bytes = min(rows * ctx->input_row, ctx->input_size);
+	uintptr_t end = ((uintptr_t)ctx->input + bytes) & ~(page - 1);
+
+	if (end > ctx->released) {
+		madvise((void *)ctx->released, end - ctx->released, MADV_DONTNEED);
+		ctx->released = end;
+	}
+}
+
+// Gray level of the pixel at `index` of the rescaled image, interpolated from `source`
+// with the same arithmetic as rescale_image() and rescale_gray()
+static unsigned char stream_pixel(ThreadData* data, ppm_image *source, int index) {
+	ppm_image* image = data->scaled_image;
+	float u = (float)(index / image->y) / (float)(image->x - 1);
+	float v = (float)(index % image->y) / (float)(image->y - 1);
+
+	if (data->ctx->gray) {
+		return sample_bicubic_gray(data->ctx->gray, data->image->x, data->image->y, u, v);
+	}
+
+	uint8_t sample[3];
+	sample_bicubic(source, u, v, sample);
+	return (sample[0] + sample[1] + sample[2]) / 3;
+}
+
+// Low-memory replacement of the rescale and of sample_grid(). sample_grid() only reads the
+// pixels under the grid points and march() overwrites all of them, so only those pixels
+// are interpolated, straight into the grid. Blocks of grid columns read the source rows in
+// order; after every block, the input rows that no later block reads are released.
+static void sample_grid_streaming(unsigned char sigma, ThreadData* data, ppm_image *source) {
+	ms_context* ctx = data->ctx;
+	ppm_image* image = data->scaled_image;
+	int p = image->x / data->step_x;
+	int q = image->y / data->step_y;
+	int source_rows = ctx->gray ? data->image->y : source->y;
+
+	// Compute the [start, end) section of the p + 1 grid rows that the thread will work on
+	int start_i = data->id * (double)(p + 1) / data->num_threads;
+	int end_i = min((data->id + 1) * (double)(p + 1) / data->num_threads, p + 1);
+
+	for (int j0 = 0; j0 <= q; j0 += STREAM_BLOCK) {
+		int j1 = min(j0 + STREAM_BLOCK, q + 1);
+
+		for (int i = start_i; i < end_i; i++) {
+			for (int j = j0; j < j1; j++) {
+				// The last row / column is sampled on the last pixel row / column of the
+				// image, at the same index as in sample_grid()
+				int index;
+				if (i == p && j == q) {
+					data->grid[p][q] = 0;
+					continue;
+				} else if (i == p) {
+					index = (image->x - 1) * image->y + j * data->step_y;
+				} else if (j == q) {
+					index = i * data->step_x * image->y + image->x - 1;
+				} else {
+					index = i * data->step_x * image->y + j * data->step_y;
+				}
+
+				data->grid[i][j] = stream_pixel(data, source, index) > sigma ? 0 : 1;
+			}
+		}
+
+		barrier_wait(data);
+
+		// Rows above the first one read by the next block (the source is the input unless
+		// there is a mipmap, whose levels are kept)
+		if (data->id == 0 && ctx->mip_levels == 0) {
+			if (j1 > q) {
+				release_input(ctx, source_rows);
+			} else {
+				float v = (float)(j1 * data->step_y) / (float)(image->y - 1);
+				float y = (v * source_rows) - 0.5;
+				int first = (int)y - 2;
+				if (first > 0) {
+					release_input(ctx, first);
+				}
+			}
+		}
+	}
+}
+
+// Marks the start of a stage on the timeline and in the timing report
+static void stage_begin(ThreadData* data, ms_stage stage) {
+	trace_begin(ms_stage_name(stage));
+	ms_stage_begin(data->timing, stage);
+}
+
+// Marks the end of a stage that processed `items` pixels or grid points of `size` bytes
+static void stage_end(ThreadData* data, ms_stage stage, int64_t items, size_t size) {
+	ms_stage_end(data->timing, stage, items, items * size);
+	trace_end(ms_stage_name(stage));
+}
+
+// Number of rows of `n` that the thread works on
+static int64_t share(ThreadData* data, int n) {
+	int start = data->id * (double)n / data->num_threads;
+	int end = min((data->id + 1) * (double)n / data->num_threads, n);
+	return end - start;
+}
+
+// Number of blocks along a side of `n` cells on a level of the quadtree
+static int level_size(int n, int level) {
+	return ((n - 1) >> level) + 1;
+}
+
+// Builds the quadtree over the cells of the grid, one level at a time. A cell of level 0
+// holds its configuration; a block holds the configuration shared by its four children
+// when it is filled by a single-colored tile, and MIXED otherwise.
+static void build_pyramid(ThreadData* data, int p, int q) {
+	ms_context* ctx = data->ctx;
+	unsigned char** grid = data->grid;
+	unsigned char* cells = ctx->pyramid[0];
+
+	// Compute the [start, end) section that the thread will work on
+	int start_i = data->id * (double)p / data->num_threads;
+	int end_i = min((data->id + 1) * (double)p / data->num_threads, p);
+
+	for (int i = start_i; i < end_i; i++) {
+		for (int j = 0; j < q; j++) {
+			cells[i * q + j] = 8 * grid[i][j] + 4 * grid[i][j + 1] +
+							   2 * grid[i + 1][j + 1] + 1 * grid[i + 1][j];
+		}
+	}
+
+	for (int level = 1; level < PYRAMID_LEVELS; level++) {
+		unsigned char* below = ctx->pyramid[level - 1];
+		unsigned char* blocks = ctx->pyramid[level];
+		int rows = level_size(p, level), cols = level_size(q, level);
+		int below_rows = level_size(p, level - 1), below_cols = level_size(q, level - 1);
+
+		// The level below must be complete before it is summarized
+		barrier_wait(data);
+
+		int start = data->id * (double)rows / data->num_threads;
+		int end = min((data->id + 1) * (double)rows / data->num_threads, rows);
+
+		for (int i = start; i < end; i++) {
+			for (int j = 0; j < cols; j++) {
+				unsigned char k = below[2 * i * below_cols + 2 * j];
+				int uniform = k != MIXED && ctx->tile_uniform[k];
+
+				// Blocks on the last row / column may have a single child on that side
+				for (int a = 2 * i; a < 2 * i + 2 && a < below_rows && uniform; a++) {
+					for (int b = 2 * j; b < 2 * j + 2 && b < below_cols && uniform; b++) {
+						uniform = below[a * below_cols + b] == k;
+					}
+				}
+
+				blocks[i * cols + j] = uniform ? k : MIXED;
+			}
+		}
+	}
+
+	barrier_wait(data);
+}
+
+// Fills the cells [i0, i1) x [j0, j1) with the single color of their contour tile
+static void fill_block(ppm_image *image, ppm_pixel color, int i0, int i1, int j0, int j1,
+					   ThreadData* data) {
+	int width = (j1 - j0) * data->step_y;
+	ppm_pixel* first = &image->data[i0 * data->step_x * image->y + j0 * data->step_y];
+
+	for (int b = 0; b < width; b++) {
+		first[b] = color;
+	}
+
+	// The other rows are copies of the first one
+	for (int a = i0 * data->step_x + 1; a < i1 * data->step_x; a++) {
+		memcpy(&image->data[a * image->y + j0 * data->step_y], first, width * sizeof(ppm_pixel));
+	}
+}
+
+// Contours the block (bi, bj) of `level`, restricted to the cell rows [start_i, end_i).
+// Homogeneous blocks are filled at once; mixed blocks are split into their four children.
+static void march_block(ppm_image *image, ThreadData* data, int level, int bi, int bj,
+						int start_i, int end_i, int p, int q) {
+	ms_context* ctx = data->ctx;
+	unsigned char k = ctx->pyramid[level][bi * level_size(q, level) + bj];
+
+	int i0 = bi << level, i1 = min((bi + 1) << level, p);
+	int j0 = bj << level, j1 = min((bj + 1) << level, q);
+	if (i0 < start_i) {
+		i0 = start_i;
+	}
+	if (i1 > end_i) {
+		i1 = end_i;
+	}
+	if (i0 >= i1) {
+		return;
+	}
+
+	if (k != MIXED && ctx->tile_uniform[k]) {
+		fill_block(image, ctx->tile_color[k], i0, i1, j0, j1, data);
+	} else if (level == 0) {
+		// Same as update_image(), copying the tile a row at a time
+		ppm_image* contour = data->contour_map[k];
+		for (int a = 0; a < contour->x; a++) {
+			memcpy(&image->data[(bi * data->step_x + a) * image->y + bj * data->step_y],
+				   &contour->data[contour->x * a], contour->y * sizeof(ppm_pixel));
+		}
+	} else {
+		for (int a = 2 * bi; a < 2 * bi + 2 && a < level_size(p, level - 1); a++) {
+			for (int b = 2 * bj; b < 2 * bj + 2 && b < level_size(q, level - 1); b++) {
+				march_block(image, data, level - 1, a, b, start_i, end_i, p, q);
+			}
+		}
+	}
+}
+
+// Same as march(), walking the quadtree from the root instead of visiting every cell
+static void march_quadtree(ppm_image *image, ThreadData* data) {
+	int p = image->x / data->step_x;
+	int q = image->y / data->step_y;
+
+	build_pyramid(data, p, q);
+
+	// Compute the [start, end) section that the thread will work on
+	int start_i = data->id * (double)p / data->num_threads;
+	int end_i = min((data->id + 1) * (double)p / data->num_threads, p);
+
+	// The quadtree is walked once per row of cells, so the image is still written row by
+	// row; a homogeneous block is then filled with one pass over each of its rows
+	int top = PYRAMID_LEVELS - 1;
+	for (int i = start_i; i < end_i; i++) {
+		for (int bj = 0; bj < level_size(q, top); bj++) {
+			march_block(image, data, top, i >> top, bj, i, i + 1, p, q);
+		}
+	}
+}
+
+// Labels the connected regions of the grid; every step works on the band of grid rows
+// of the thread and needs the previous one to be complete on all the bands
+static void label_regions(ThreadData* data, int p, int q) {
+	ms_regions* regions = data->ctx->regions;
+
+	// Compute the [start, end) section that the thread will work on
+	int start = data->id * (double)(p + 1) / data->num_threads;
+	int end = min((data->id + 1) * (double)(p + 1) / data->num_threads, p + 1);
+
+	stage_begin(data, STAGE_REGIONS);
+	regions_label_band(regions, data->grid, start, end);
+	barrier_wait(data);
+	regions_merge_band(regions, data->grid, start, end);
+	barrier_wait(data);
+	regions_flatten_band(regions, data->id, start, end);
+	barrier_wait(data);
+	regions_number_band(regions, data->id, start, end);
+	barrier_wait(data);
+	regions_measure_band(regions, start, end);
+	stage_end(data, STAGE_REGIONS, share(data, p + 1) * (q + 1), sizeof(int));
+}
+
+// Function that will be executed by each thread for every job
+static void* parallel_marching_squares(void* arg) {
+	ThreadData* data = (ThreadData*)arg;
+	int rescaled = data->image->x > RESCALE_X || data->image->y > RESCALE_Y;
+
+	// Rescale the original image, from the last level of its mipmap if there is one
+	data->tile_pixels = 0;
+	stage_begin(data, STAGE_RESCALE);
+	ppm_image* source = data->image;
+	for (int l = 0; l < data->ctx->mip_levels; l++) {
+		reduce_image(source, &data->ctx->mip[l], data);
+		barrier_wait(data);
+		source = &data->ctx->mip[l];
+
+		// The input is only read by the first reduction
+		if (l == 0 && data->ctx->stream && data->id == 0) {
+			release_input(data->ctx, data->ctx->source.y);
+		}
+	}
+	if (data->ctx->stream) {
+		// Sampled together with the grid
+	} else if (data->ctx->gray) {
+		rescale_gray(data);
+	} else if (data->ctx->use_layout) {
+		data->scaled_image = rescale_image_layout(data, source);
+	} else {
+		data->scaled_image = rescale_image(data, source);
+	}
+	stage_end(data, STAGE_RESCALE, rescaled ? data->tile_pixels : 0, sizeof(ppm_pixel));
+
+	// Wait for all threads to complete this stage before continuing
+	barrier_wait(data);
+
+	int p = data->scaled_image->x / data->step_x;
+	int q = data->scaled_image->y / data->step_y;
+
+	// Compute the grid for the scaled image
+	stage_begin(data, STAGE_GRID);
+	if (data->ctx->stream) {
+		sample_grid_streaming(SIGMA, data, source);
+	} else {
+		data->grid = sample_grid(SIGMA, data);
+	}
+	stage_end(data, STAGE_GRID,
+			  share(data, p) * (q + 1) + share(data, q), sizeof(ppm_pixel));
+
+	// Wait for all threads to complete this stage before continuing
+	barrier_wait(data);
+
+	// The contour image does not depend on the regions, so march right away
+	if (data->ctx->regions) {
+		label_regions(data, p, q);
+	}
+
+	// Create the contour image
+	stage_begin(data, STAGE_MARCH);
+	if (data->ctx->quadtree && p > 0 && q > 0) {
+		march_quadtree(data->scaled_image, data);
+	} else {
+		march(data->scaled_image, data->grid, data->contour_map, data);
+	}
+	stage_end(data, STAGE_MARCH,
+			  share(data, p) * q * data->step_x * data->step_y, sizeof(ppm_pixel));
+	barrier_wait(data);
+
+	return NULL;
+}
+
+// Main loop of a pool worker: wait for a job, run it, report completion
+static void* worker_loop(void* arg) {
+	ThreadData* data = (ThreadData*)arg;
+	ms_context* ctx = data->ctx;
+
+	trace_thread("worker", data->id);
+
+	while (1) {
+		pthread_barrier_wait(&ctx->start_barrier);
+		if (ctx->shutdown) {
+			break;
+		}
+
+		parallel_marching_squares(data);
+		pthread_barrier_wait(&ctx->done_barrier);
+	}
+
+	return NULL;
+}
+
+void ms_output_size(int w, int h, int *out_x, int *out_y) {
+	// We only rescale downwards
+	if (w <= RESCALE_X && h <= RESCALE_Y) {
+		*out_x = w;
+		*out_y = h;
+	} else {
+		*out_x = RESCALE_X;
+		*out_y = RESCALE_Y;
+	}
+}
+
+// Frees the contour tiles and the grid, whichever of them were allocated
+static void free_resources(ms_context *ctx) {
+	if (ctx->contour_map) {
+		for (int i = 0; i < CONTOUR_CONFIG_COUNT; i++) {
+			free(ctx->contour_map[i]->data);
+			free(ctx->contour_map[i]);
+		}
+		free(ctx->contour_map);
+	}
+
+	if (ctx->grid) {
+		for (int i = 0; i <= RESCALE_X / STEP; i++) {
+			free(ctx->grid[i]);
+		}
+		free(ctx->grid);
+	}
+
+	for (int i = 0; i < PYRAMID_LEVELS; i++) {
+		free(ctx->pyramid[i]);
+	}
+	free(ctx->mip_buffer[0]);
+	free(ctx->mip_buffer[1]);
+	free(ctx->layout_buffer);
+	free(ctx->luma);
+
+	free(ctx->threads);
+	free(ctx->thread_data);
+	free(ctx);
+}
+
+ms_context *ms_create(int num_threads, const char *contours_dir) {
+	if (num_threads < 1) {
+		return NULL;
+	}
+
+	ms_context *ctx = (ms_context *)calloc(1, sizeof(ms_context));
+	if (!ctx) {
+		return NULL;
+	}
+
+	ctx->num_threads = num_threads;
+	ctx->tiling = 1;
+	ctx->threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+	ctx->thread_data = (ThreadData *)calloc(num_threads, sizeof(ThreadData));
+	ctx->contour_map = init_contour_map(contours_dir);
+	if (!ctx->threads || !ctx->thread_data || !ctx->contour_map) {
+		free_resources(ctx);
+		return NULL;
+	}
+
+	// The grid is sized for the largest image the pipeline can produce, so it is
+	// allocated once and reused by every job
+	ctx->grid = (unsigned char **)calloc(RESCALE_X / STEP + 1, sizeof(unsigned char*));
+	if (!ctx->grid) {
+		free_resources(ctx);
+		return NULL;
+	}
+
+	for (int i = 0; i <= RESCALE_X / STEP; i++) {
+		ctx->grid[i] = (unsigned char *)malloc((RESCALE_Y / STEP + 1) * sizeof(unsigned char));
+		if (!ctx->grid[i]) {
+			free_resources(ctx);
+			return NULL;
+		}
+	}
+
+	// The quadtree is sized for the largest grid as well
+	for (int i = 0; i < PYRAMID_LEVELS; i++) {
+		int rows = level_size(RESCALE_X / STEP, i), cols = level_size(RESCALE_Y / STEP, i);
+		ctx->pyramid[i] = (unsigned char *)malloc(rows * cols * sizeof(unsigned char));
+		if (!ctx->pyramid[i]) {
+			free_resources(ctx);
+			return NULL;
+		}
+	}
+
+	// Single-colored tiles (e.g. all background) can be filled without blitting them
+	for (int k = 0; k < CONTOUR_CONFIG_COUNT; k++) {
+		ppm_image* tile = ctx->contour_map[k];
+		int uniform = tile->x == STEP && tile->y == STEP;
+
+		for (int i = 1; i < tile->x * tile->y && uniform; i++) {
+			uniform = !memcmp(&tile->data[i], &tile->data[0], sizeof(ppm_pixel));
+		}
+
+		ctx->tile_uniform[k] = uniform;
+		ctx->tile_color[k] = tile->data[0];
+	}
+
+	// Initialize the barriers used by the workers
+	if (pthread_barrier_init(&ctx->barrier, NULL, num_threads)) {
+		free_resources(ctx);
+		return NULL;
+	}
+	pthread_barrier_init(&ctx->start_barrier, NULL, num_threads + 1);
+	pthread_barrier_init(&ctx->done_barrier, NULL, num_threads + 1);
+
+	// Create the threads that will parallelize the marching squares algorithm
+	for (int i = 0; i < num_threads; i++) {
+		ctx->thread_data[i].id = i;
+		ctx->thread_data[i].num_threads = num_threads;
+		ctx->thread_data[i].barrier = &ctx->barrier;
+		ctx->thread_data[i].contour_map = ctx->contour_map;
+		ctx->thread_data[i].grid = ctx->grid;
+		ctx->thread_data[i].step_x = STEP;
+		ctx->thread_data[i].step_y = STEP;
+		ctx->thread_data[i].ctx = ctx;
+
+		pthread_create(&ctx->threads[i], NULL, worker_loop, &ctx->thread_data[i]);
+	}
+
+	return ctx;
+}
+
+void ms_destroy(ms_context *ctx) {
+	if (!ctx) {
+		return;
+	}
+
+	// Release the workers with the shutdown flag set and join them
+	ctx->shutdown = 1;
+	pthread_barrier_wait(&ctx->start_barrier);
+
+	for (int i = 0; i < ctx->num_threads; i++) {
+		pthread_join(ctx->threads[i], NULL);
+	}
+
+	pthread_barrier_destroy(&ctx->barrier);
+	pthread_barrier_destroy(&ctx->start_barrier);
+	pthread_barrier_destroy(&ctx->done_barrier);
+
+	free_resources(ctx);
+}
+
+void ms_set_timing(ms_context *ctx, ms_timing *timing) {
+	ctx->timing = timing;
+}
+
+void ms_set_regions(ms_context *ctx, ms_regions *regions) {
+	ctx->regions = regions;
+}
+
+void ms_set_quadtree(ms_context *ctx, int enable) {
+	ctx->quadtree = enable;
+}
+
+void ms_set_mipmap(ms_context *ctx, int enable) {
+	ctx->mipmap = enable;
+}
+
+void ms_set_layout(ms_context *ctx, ms_layout layout) {
+	ctx->layout = layout;
+}
+
+void ms_set_low_memory(ms_context *ctx, int enable) {
+	ctx->low_memory = enable;
+}
+
+void ms_set_tiling(ms_context *ctx, int enable) {
+	ctx->tiling = enable;
+}
+
+void ms_set_tile_size(ms_context *ctx, int size) {
+	ctx->fixed_tile = size > 0 ? size : 0;
+}
+
+// Sizes the tiles of a job that rescales a `w` x `h` source with `bpp` bytes per pixel:
+// the largest power of two whose source footprint (the rows and the cache lines of the
+// columns under a tile, plus the 4x4 neighborhood) fits in half of the L2 cache
+static void plan_tiles(ms_context *ctx, ppm_image *out, int w, int h, int bpp) {
+	long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if (l2 <= 0) {
+		l2 = DEFAULT_L2_SIZE;
+	}
+
+	int tile = MAX_TILE;
+	while (tile > MIN_TILE) {
+		long rows = (long)tile * h / out->y + 4;
+		long lines = ((long)tile * w / out->x + 4) * bpp / 64 + 2;
+		if (rows * lines * 64 <= l2 / 2) {
+			break;
+		}
+		tile /= 2;
+	}
+
+	if (ctx->fixed_tile) {
+		tile = ctx->fixed_tile;
+	}
+
+	ctx->tile_size = tile;
+	ctx->tile_rows = (out->x + tile - 1) / tile;
+	ctx->tile_cols = (out->y + tile - 1) / tile;
+	ctx->next_tile = 0;
+}
+
+// Streams the rescale of the job into the grid when the context is in low-memory mode,
+// releasing the `size` bytes of `input` (`row` bytes per row) along the way
+static void plan_stream(ms_context *ctx, const void *input, size_t row, size_t size) {
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+
+	ctx->input = (uint8_t *)input;
+	ctx->input_row = row;
+	ctx->input_size = size;
+	ctx->released = ((uintptr_t)input + page - 1) & ~(page - 1);
+}
+
+// Allocates the luminance plane of the rescaled image on the first job that needs it
+static int alloc_luma(ms_context *ctx) {
+	if (!ctx->luma) {
+		ctx->luma = (unsigned char *)aligned_alloc(64, RESCALE_X * RESCALE_Y);
+		if (!ctx->luma) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// Sizes the buffers of the converted source and of the luminance plane for a job that
+// rescales a `w` x `h` source (the last level of the mipmap, if any)
+static int plan_layout(ms_context *ctx, int w, int h) {
+	size_t size = (size_t)w * h * (ctx->layout == MS_LAYOUT_RGBX ? 4 : 3);
+	size = (size + 63) / 64 * 64;
+
+	if (size > ctx->layout_capacity) {
+		free(ctx->layout_buffer);
+		ctx->layout_capacity = 0;
+		ctx->layout_buffer = (uint8_t *)aligned_alloc(64, size);
+		if (!ctx->layout_buffer) {
+			return -1;
+		}
+		ctx->layout_capacity = size;
+	}
+
+	return alloc_luma(ctx);
+}
+
+// Plans the mipmap of a `w` x `h` image: the image is halved while both of its sides stay
+// at least as large as the rescaled image, so bicubic sampling still only reduces it
+static int plan_mipmap(ms_context *ctx, int w, int h) {
+	ctx->mip_levels = 0;
+
+	while (ctx->mipmap && ctx->mip_levels < MIPMAP_LEVELS &&
+		   (w + 1) / 2 >= RESCALE_X && (h + 1) / 2 >= RESCALE_Y) {
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+
+		// Levels alternate between two buffers, which only grow
+		int b = ctx->mip_levels % 2;
+		size_t size = (size_t)w * h * sizeof(ppm_pixel);
+		if (size > ctx->mip_capacity[b]) {
+			ppm_pixel* buffer = (ppm_pixel *)realloc(ctx->mip_buffer[b], size);
+			if (!buffer) {
+				ctx->mip_levels = 0;
+				return -1;
+			}
+			ctx->mip_buffer[b] = buffer;
+			ctx->mip_capacity[b] = size;
+		}
+
+		ppm_image* level = &ctx->mip[ctx->mip_levels++];
+		level->x = w;
+		level->y = h;
+		level->data = ctx->mip_buffer[b];
+	}
+
+	return 0;
+}
+
+// Hands the job described by the context to the workers and waits for them to finish it
+static void run_job(ms_context *ctx, ppm_image *out) {
+	if (ctx->regions) {
+		ctx->regions->rows = out->x / STEP + 1;
+		ctx->regions->cols = out->y / STEP + 1;
+	}
+
+	for (int i = 0; i < ctx->num_threads; i++) {
+		ctx->thread_data[i].image = &ctx->source;
+		ctx->thread_data[i].scaled_image = &ctx->output;
+		ctx->thread_data[i].timing = ctx->timing ? &ctx->timing->threads[i] : NULL;
+	}
+
+	pthread_barrier_wait(&ctx->start_barrier);
+	pthread_barrier_wait(&ctx->done_barrier);
+}
+
+int ms_process(ms_context *ctx, const ppm_pixel *in_pixels, int w, int h, ppm_image *out) {
+	if (!ctx || !in_pixels || !out || !out->data || w <= 0 || h <= 0) {
+		return -1;
+	}
+
+	ms_output_size(w, h, &out->x, &out->y);
+
+	ctx->output = *out;
+	if (out->x == w && out->y == h) {
+		// Images that are not rescaled are contoured directly in the output buffer
+		if (out->data != in_pixels) {
+			memcpy(out->data, in_pixels, (size_t)w * h * sizeof(ppm_pixel));
+		}
+		ctx->source = *out;
+	} else {
+		ctx->source.x = w;
+		ctx->source.y = h;
+		ctx->source.data = (ppm_pixel *)in_pixels;
+	}
+
+	if (plan_mipmap(ctx, w, h)) {
+		return -1;
+	}
+
+	ctx->stream = ctx->low_memory && (out->x != w || out->y != h);
+	plan_stream(ctx, in_pixels, (size_t)w * sizeof(ppm_pixel), (size_t)w * h * sizeof(ppm_pixel));
+
+	// Images that are not rescaled are only sampled at the grid points, so they are not
+	// converted, and neither are the streamed ones
+	ctx->use_layout = ctx->layout != MS_LAYOUT_PACKED && (out->x != w || out->y != h) &&
+					  !ctx->stream;
+	ppm_image *last = ctx->mip_levels ? &ctx->mip[ctx->mip_levels - 1] : &ctx->source;
+	if (ctx->use_layout && plan_layout(ctx, last->x, last->y)) {
+		return -1;
+	}
+	plan_tiles(ctx, out, last->x, last->y, ctx->use_layout && ctx->layout == MS_LAYOUT_RGBX ? 4 : 3);
+
+	ctx->gray = NULL;
+	ctx->grid_luma = ctx->use_layout ? ctx->luma : NULL;
+
+	run_job(ctx, out);
+	return 0;
+}
+
+int ms_process_gray(ms_context *ctx, const uint8_t *in_gray, int w, int h, ppm_image *out) {
+	if (!ctx || !in_gray || !out || !out->data || w <= 0 || h <= 0) {
+		return -1;
+	}
+
+	ms_output_size(w, h, &out->x, &out->y);
+
+	ctx->output = *out;
+	ctx->source.x = w;
+	ctx->source.y = h;
+	ctx->source.data = NULL;
+	ctx->gray = in_gray;
+	ctx->mip_levels = 0;
+	ctx->use_layout = 0;
+	ctx->stream = ctx->low_memory && (out->x != w || out->y != h);
+	plan_stream(ctx, in_gray, w, (size_t)w * h);
+
+	// The grid of an image that is not rescaled is sampled from the input itself
+	if (out->x == w && out->y == h) {
+		ctx->grid_luma = in_gray;
+	} else if (ctx->stream) {
+		ctx->grid_luma = NULL;
+	} else {
+		plan_tiles(ctx, out, w, h, 1);
+		if (alloc_luma(ctx)) {
+			return -1;
+		}
+		ctx->grid_luma = ctx->luma;
+	}
+
+	run_job(ctx, out);
+	return 0;
+}
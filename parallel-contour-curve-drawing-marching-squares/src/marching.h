@@ -0,0 +1,86 @@
+// Reusable marching squares library (libmarching)
+
+#ifndef MARCHING_H
+#define MARCHING_H
+
+#include "helpers.h"
+#include "regions.h"
+#include "timing.h"
+
+// Layout of the source image during the bicubic rescale
+typedef enum {
+    MS_LAYOUT_PACKED,               // ppm_pixel, 3 bytes per pixel (no conversion)
+    MS_LAYOUT_RGBX,                 // 4-byte pixels, aligned
+    MS_LAYOUT_PLANAR                // One plane per channel, aligned
+} ms_layout;
+
+// Opaque context that owns the worker threads, the contour tiles and the grid.
+// A context processes one image at a time; use one context per calling thread.
+typedef struct ms_context ms_context;
+
+// Creates a context with `num_threads` warm workers and loads the 16 contour
+// tiles from `contours_dir`. Returns NULL on failure.
+ms_context *ms_create(int num_threads, const char *contours_dir);
+
+// Stops the workers and releases every resource owned by the context.
+void ms_destroy(ms_context *ctx);
+
+// Computes the size of the contour image produced for a `w` x `h` input.
+void ms_output_size(int w, int h, int *out_x, int *out_y);
+
+// Records per-thread stage timings of the next jobs into `timing`, which must have been
+// created for the same number of threads. Passing NULL disables the instrumentation.
+void ms_set_timing(ms_context *ctx, ms_timing *timing);
+
+// Labels the connected regions of the grid of the next jobs into `regions`, which must
+// have been created for the same number of threads. Passing NULL disables the labeling.
+void ms_set_regions(ms_context *ctx, ms_regions *regions);
+
+// When enabled, march() builds a quadtree over the cells of the grid and fills every
+// block that maps to a single-colored contour tile at once, only visiting the cells of
+// the mixed blocks. The output is the same.
+void ms_set_quadtree(ms_context *ctx, int enable);
+
+// When enabled, images at least twice as large as the rescaled image on both sides are
+// first halved with a 2x2 box filter, as many times as possible, and the bicubic rescale
+// samples the last level. This reads the input sequentially, but changes the output.
+void ms_set_mipmap(ms_context *ctx, int enable);
+
+// Selects the layout the source is converted to, in parallel, before it is rescaled. The
+// rescale then also produces a luminance plane, which is the only input of sample_grid().
+// The output is the same for every layout; images that are not rescaled are not converted.
+void ms_set_layout(ms_context *ctx, ms_layout layout);
+
+// When enabled (the default), the bicubic rescale works on square tiles of the output,
+// sized so that the source pixels under a tile fit in half of the L2 cache, and the
+// threads claim the tiles dynamically. Otherwise, every thread rescales a band of whole
+// rows. The output is the same.
+void ms_set_tiling(ms_context *ctx, int enable);
+
+// Sets the side of the rescale tiles, in output pixels; 0 (the default) sizes them for
+// the L2 cache of the host.
+void ms_set_tile_size(ms_context *ctx, int size);
+
+// When enabled, rescaled images are never stored at full resolution: only the pixels
+// under the grid points are interpolated, straight into the grid, since march()
+// overwrites all the others. The input is read in order and its pages are returned to
+// the system (madvise) as soon as the rescale is past them, so the input must be a
+// private buffer the caller does not need afterwards: its content is undefined after the
+// call. The layout option is ignored for those images. The output is the same.
+void ms_set_low_memory(ms_context *ctx, int enable);
+
+// Runs the marching squares pipeline on the in-memory `in_pixels` buffer.
+// `out->data` must be able to hold the number of pixels given by `ms_output_size`;
+// `out->x` and `out->y` are filled in by the call. When the input is not rescaled,
+// `in_pixels` may be equal to `out->data` and the image is processed in place.
+// Returns 0 on success and -1 on invalid arguments or allocation failure.
+int ms_process(ms_context *ctx, const ppm_pixel *in_pixels, int w, int h, ppm_image *out);
+
+// Same as ms_process() for a grayscale image with one byte per pixel, which is equivalent
+// to a color image with the same value on the three channels. The grid is sampled from
+// the gray values, which are never widened to RGB except for the output pixels march()
+// does not cover. `in_gray` cannot be the output buffer, and the mipmap and the layout
+// options are ignored.
+int ms_process_gray(ms_context *ctx, const uint8_t *in_gray, int w, int h, ppm_image *out);
+
+#endif
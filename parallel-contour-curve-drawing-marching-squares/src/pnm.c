@@ -0,0 +1,338 @@
+// Readers for the binary and ASCII Netpbm formats (P2, P3, P5, P6)
+
+#include "pnm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Find the minimum out of two numbers
+#define min(a, b) a < b ? a : b
+
+// Samples of a file converted by the threads of read_pnm()
+typedef struct {
+	const unsigned char *src;	// Payload of the file, padded with 8 zero bytes
+	size_t length;				// Length of the payload, without the padding
+	int ascii;
+	int maxval;
+	size_t samples;				// Number of samples of the image
+	uint8_t *dst;				// Output samples, scaled to 0..255
+	size_t *counts;				// Samples found by each thread in an ASCII payload
+	int error;
+} ParseJob;
+
+// Structure used to pass data to the thread function
+typedef struct {
+	int id;
+	int num_threads;
+	pthread_barrier_t *barrier;
+	ParseJob *job;
+} ParseData;
+
+static inline int is_space(unsigned char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Scales a sample from 0..maxval to 0..255, rounding to the nearest value
+static inline uint8_t scale(uint32_t value, int maxval) {
+	if (maxval == RGB_COMPONENT_COLOR) {
+		return value;
+	}
+	return (value * RGB_COMPONENT_COLOR + maxval / 2) / maxval;
+}
+
+// Parses the decimal number at `p`, which must start with a digit. The first 8 bytes are
+// classified and converted at once, as 8 lanes of a 64-bit word (SWAR); longer numbers
+// continue digit by digit. Returns the first byte after the number, or NULL.
+static const unsigned char *parse_number(const unsigned char *p, uint32_t *value) {
+	uint64_t chunk;
+	memcpy(&chunk, p, sizeof(chunk));
+
+	// A byte is a digit when its high nibble is 3 and it stays below 0x3A; bytes of `y`
+	// are 0x33 exactly for the digits. A carry from a non-digit byte can only change the
+	// bytes after it, which are not part of the number.
+	uint64_t y = (chunk & 0xF0F0F0F0F0F0F0F0ULL) |
+				 (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4);
+	uint64_t z = y ^ 0x3333333333333333ULL;
+	uint64_t nonzero = (((z & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL) | z) &
+					   0x8080808080808080ULL;
+	int n = nonzero ? __builtin_ctzll(nonzero) / 8 : 8;
+
+	if (n == 0) {
+		return NULL;
+	}
+
+	// Move the n digits to the top lanes, so the lanes below read as leading zeros, then
+	// combine pairs, quads and octets of digits
+	uint64_t digits = (chunk - 0x3030303030303030ULL) << (8 * (8 - n));
+	digits = ((digits & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+	digits = ((digits & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+	uint64_t number = ((digits & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+
+	p += n;
+	while (n == 8 && *p >= '0' && *p <= '9') {
+		number = number * 10 + (*p++ - '0');
+		if (number > 65535) {
+			return NULL;
+		}
+	}
+
+	*value = number;
+	return p;
+}
+
+// First byte of the ASCII payload handled by the thread: the chunks are split at equal
+// offsets, and a number belongs to the chunk where it starts
+static size_t chunk_start(ParseData *data, size_t length) {
+	size_t start = data->id * (double)length / data->num_threads;
+	size_t end = min((data->id + 1) * (double)length / data->num_threads, length);
+
+	while (start > 0 && start < end && !is_space(data->job->src[start - 1])) {
+		start++;
+	}
+	return start;
+}
+
+static void *thread_function(void *arg) {
+	ParseData *data = (ParseData *)arg;
+	ParseJob *job = data->job;
+
+	if (!job->ascii) {
+		// Binary samples are 1 or 2 bytes (big-endian) each
+		size_t start = data->id * (double)job->samples / data->num_threads;
+		size_t end = min((data->id + 1) * (double)job->samples / data->num_threads, job->samples);
+
+		for (size_t i = start; i < end; i++) {
+			uint32_t value = job->maxval > 255 ? (job->src[2 * i] << 8) | job->src[2 * i + 1] :
+												 job->src[i];
+			if (value > (uint32_t)job->maxval) {
+				job->error = 1;
+				return NULL;
+			}
+			job->dst[i] = scale(value, job->maxval);
+		}
+
+		return NULL;
+	}
+
+	size_t start = chunk_start(data, job->length);
+	size_t end = min((data->id + 1) * (double)job->length / data->num_threads, job->length);
+
+	// Count the numbers of the chunk, so the threads know where to store theirs
+	size_t count = 0;
+	for (size_t i = start; i < end; i++) {
+		count += !is_space(job->src[i]) && (i == 0 || is_space(job->src[i - 1]));
+	}
+	job->counts[data->id] = count;
+
+	pthread_barrier_wait(data->barrier);
+
+	size_t index = 0;
+	for (int i = 0; i < data->id; i++) {
+		index += job->counts[i];
+	}
+
+	const unsigned char *p = job->src + start;
+	const unsigned char *chunk_end = job->src + end;
+	while (1) {
+		while (p < chunk_end && is_space(*p)) {
+			p++;
+		}
+		if (p >= chunk_end) {
+			break;
+		}
+
+		uint32_t value;
+		p = parse_number(p, &value);
+		if (!p || value > (uint32_t)job->maxval || index >= job->samples ||
+			!(is_space(*p) || p == job->src + job->length)) {
+			job->error = 1;
+			return NULL;
+		}
+
+		job->dst[index++] = scale(value, job->maxval);
+	}
+
+	return NULL;
+}
+
+// Converts the payload of the file with `num_threads` threads
+static int parse_samples(ParseJob *job, int num_threads) {
+	pthread_t *threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+	ParseData *data = (ParseData *)malloc(num_threads * sizeof(ParseData));
+	pthread_barrier_t barrier;
+
+	job->counts = (size_t *)calloc(num_threads, sizeof(size_t));
+	if (!threads || !data || !job->counts) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	pthread_barrier_init(&barrier, NULL, num_threads);
+
+	for (int i = 0; i < num_threads; i++) {
+		data[i].id = i;
+		data[i].num_threads = num_threads;
+		data[i].barrier = &barrier;
+		data[i].job = job;
+
+		if (pthread_create(&threads[i], NULL, thread_function, &data[i])) {
+			fprintf(stderr, "Error creating thread %d\n", i);
+			exit(-1);
+		}
+	}
+
+	for (int i = 0; i < num_threads; i++) {
+		if (pthread_join(threads[i], NULL)) {
+			fprintf(stderr, "Error waiting for thread %d\n", i);
+			exit(-1);
+		}
+	}
+
+	// Every sample of an ASCII payload must be present exactly once
+	if (job->ascii) {
+		size_t total = 0;
+		for (int i = 0; i < num_threads; i++) {
+			total += job->counts[i];
+		}
+		job->error |= total != job->samples;
+	}
+
+	pthread_barrier_destroy(&barrier);
+	free(job->counts);
+	free(threads);
+	free(data);
+
+	return job->error ? -1 : 0;
+}
+
+// Reads a header field, skipping the whitespace and the comments before it
+static int read_field(FILE *fp, int *value) {
+	int c = getc(fp);
+
+	while (c == '#' || is_space(c)) {
+		if (c == '#') {
+			while (c != '\n' && c != EOF) {
+				c = getc(fp);
+			}
+		}
+		c = getc(fp);
+	}
+
+	ungetc(c, fp);
+	return fscanf(fp, "%d", value) == 1 ? 0 : -1;
+}
+
+int read_pnm_size(const char *filename, int *x, int *y) {
+	char magic[2];
+
+	FILE *fp = fopen(filename, "rb");
+	if (!fp) {
+		return -1;
+	}
+
+	int r = fread(magic, 1, 2, fp) != 2 || magic[0] != 'P' || read_field(fp, x) ||
+			read_field(fp, y) ? -1 : 0;
+	fclose(fp);
+
+	return r;
+}
+
+pnm_image *read_pnm(const char *filename, int num_threads) {
+	char magic[2];
+	int maxval;
+
+	FILE *fp = fopen(filename, "rb");
+	if (!fp) {
+		fprintf(stderr, "Unable to open file '%s'\n", filename);
+		exit(1);
+	}
+
+	if (fread(magic, 1, 2, fp) != 2 || magic[0] != 'P' || magic[1] < '2' || magic[1] > '6' ||
+		magic[1] == '4') {
+		fprintf(stderr, "Invalid image format (must be 'P2', 'P3', 'P5' or 'P6')\n");
+		exit(1);
+	}
+
+	pnm_image *img = (pnm_image *)calloc(1, sizeof(pnm_image));
+	if (!img) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	if (read_field(fp, &img->x) || read_field(fp, &img->y) || img->x <= 0 || img->y <= 0) {
+		fprintf(stderr, "Invalid image size (error loading '%s')\n", filename);
+		exit(1);
+	}
+
+	if (read_field(fp, &maxval) || maxval <= 0 || maxval > 65535) {
+		fprintf(stderr, "Invalid maxval (error loading '%s')\n", filename);
+		exit(1);
+	}
+	img->maxval = maxval;
+
+	// A single whitespace character separates the header from the samples
+	if (!is_space(getc(fp))) {
+		fprintf(stderr, "Invalid header (error loading '%s')\n", filename);
+		exit(1);
+	}
+
+	int color = magic[1] == '3' || magic[1] == '6';
+	int ascii = magic[1] == '2' || magic[1] == '3';
+	size_t samples = (size_t)img->x * img->y * (color ? 3 : 1);
+
+	uint8_t *dst = (uint8_t *)malloc(samples);
+	if (!dst) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	if (color) {
+		img->data = (ppm_pixel *)dst;
+	} else {
+		img->gray = dst;
+	}
+
+	// 8-bit binary samples are already in their final form
+	if (!ascii && maxval == RGB_COMPONENT_COLOR) {
+		if (fread(dst, 1, samples, fp) != samples) {
+			fprintf(stderr, "Error loading image '%s'\n", filename);
+			exit(1);
+		}
+		fclose(fp);
+		return img;
+	}
+
+	// Load the rest of the file, followed by zeros so numbers can be read 8 bytes at a time
+	long offset = ftell(fp);
+	fseek(fp, 0, SEEK_END);
+	size_t length = ftell(fp) - offset;
+	fseek(fp, offset, SEEK_SET);
+
+	unsigned char *src = (unsigned char *)calloc(length + 8, 1);
+	if (!src) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	size_t expected = samples * (maxval > 255 ? 2 : 1);
+	if (fread(src, 1, length, fp) != length || (!ascii && length < expected)) {
+		fprintf(stderr, "Error loading image '%s'\n", filename);
+		exit(1);
+	}
+	fclose(fp);
+
+	ParseJob job = { src, length, ascii, maxval, samples, dst, NULL, 0 };
+	if (parse_samples(&job, num_threads > 0 ? num_threads : 1)) {
+		fprintf(stderr, "Error loading image '%s'\n", filename);
+		exit(1);
+	}
+
+	free(src);
+	return img;
+}
+
+void free_pnm(pnm_image *img) {
+	free(img->data);
+	free(img->gray);
+	free(img);
+}
@@ -0,0 +1,26 @@
+// Readers for the binary and ASCII Netpbm formats (P2, P3, P5, P6)
+
+#ifndef PNM_H
+#define PNM_H
+
+#include "helpers.h"
+
+// Image read by read_pnm(). Color images (P3, P6) fill `data`; grayscale ones (P2, P5)
+// fill `gray`, one byte per pixel, with the same indexing. Samples are scaled from
+// 0..maxval to 0..255, so 8-bit P6 images are loaded exactly as read_ppm() does.
+typedef struct {
+    int x, y;
+    int maxval;                     // Maxval of the file, up to 65535
+    ppm_pixel *data;                // NULL for grayscale images
+    uint8_t *gray;                  // NULL for color images
+} pnm_image;
+
+// Reads a P2, P3, P5 or P6 image with 8- or 16-bit samples. Binary samples are scaled
+// and ASCII files are parsed by `num_threads` threads. Exits on errors, like read_ppm().
+pnm_image *read_pnm(const char *filename, int num_threads);
+void free_pnm(pnm_image *img);
+
+// Reads only the size from the header of a Netpbm image. Returns 0 on success.
+int read_pnm_size(const char *filename, int *x, int *y);
+
+#endif
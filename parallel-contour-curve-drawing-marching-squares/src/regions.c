@@ -0,0 +1,256 @@
+// Connected-component labeling of the sample grid of the marching squares pipeline
+//
+// Every thread labels its band of grid rows into a union-find forest shared by all the
+// threads, then the bands are merged along their borders. Unions are lock-free: a root
+// is only ever linked below a smaller root with a compare-and-swap, so the root of a
+// region is its first point in raster order and concurrent unions cannot form cycles.
+
+#include "regions.h"
+#include "helpers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#define MAX_POINTS ((RESCALE_X / STEP + 1) * (RESCALE_Y / STEP + 1))
+
+ms_regions *ms_regions_create(int num_threads) {
+	ms_regions *regions = (ms_regions *)calloc(1, sizeof(ms_regions));
+	if (!regions) {
+		return NULL;
+	}
+
+	regions->num_threads = num_threads;
+	regions->parent = (int *)malloc(MAX_POINTS * sizeof(int));
+	regions->label = (int *)malloc(MAX_POINTS * sizeof(int));
+	regions->band_count = (int *)calloc(num_threads, sizeof(int));
+	regions->regions = (ms_region *)malloc(MAX_POINTS * sizeof(ms_region));
+	if (!regions->parent || !regions->label || !regions->band_count || !regions->regions) {
+		ms_regions_destroy(regions);
+		return NULL;
+	}
+
+	return regions;
+}
+
+void ms_regions_destroy(ms_regions *regions) {
+	if (!regions) {
+		return;
+	}
+
+	free(regions->parent);
+	free(regions->label);
+	free(regions->band_count);
+	free(regions->regions);
+	free(regions);
+}
+
+// Finds the root of `x`, halving the path on the way. Halving only replaces a parent
+// with one of its ancestors, so it is safe while other threads link roots.
+static int find(int *parent, int x) {
+	while (1) {
+		int p = __atomic_load_n(&parent[x], __ATOMIC_ACQUIRE);
+		if (p == x) {
+			return x;
+		}
+
+		int gp = __atomic_load_n(&parent[p], __ATOMIC_ACQUIRE);
+		if (gp != p) {
+			__atomic_compare_exchange_n(&parent[x], &p, gp, 0, __ATOMIC_RELEASE,
+										__ATOMIC_RELAXED);
+		}
+		x = gp;
+	}
+}
+
+// Merges the regions of `a` and `b`, linking the larger root below the smaller one
+static void unite(int *parent, int a, int b) {
+	while (1) {
+		a = find(parent, a);
+		b = find(parent, b);
+		if (a == b) {
+			return;
+		}
+
+		if (a < b) {
+			int t = a;
+			a = b;
+			b = t;
+		}
+
+		// Fails if `a` stopped being a root in the meantime, so retry from the new roots
+		int expected = a;
+		if (__atomic_compare_exchange_n(&parent[a], &expected, b, 0, __ATOMIC_RELEASE,
+										__ATOMIC_RELAXED)) {
+			return;
+		}
+	}
+}
+
+void regions_label_band(ms_regions *regions, unsigned char **grid, int start, int end) {
+	int cols = regions->cols;
+
+	for (int i = start; i < end; i++) {
+		for (int j = 0; j < cols; j++) {
+			int x = i * cols + j;
+
+			if (!grid[i][j]) {
+				regions->parent[x] = -1;
+				continue;
+			}
+
+			regions->parent[x] = x;
+			if (j > 0 && grid[i][j - 1]) {
+				unite(regions->parent, x, x - 1);
+			}
+			if (i > start && grid[i - 1][j]) {
+				unite(regions->parent, x, x - cols);
+			}
+		}
+	}
+}
+
+void regions_merge_band(ms_regions *regions, unsigned char **grid, int start, int end) {
+	if (start == 0 || start == end) {
+		return;
+	}
+
+	int cols = regions->cols;
+	for (int j = 0; j < cols; j++) {
+		if (grid[start][j] && grid[start - 1][j]) {
+			unite(regions->parent, start * cols + j, (start - 1) * cols + j);
+		}
+	}
+}
+
+void regions_flatten_band(ms_regions *regions, int id, int start, int end) {
+	int count = 0;
+
+	for (int x = start * regions->cols; x < end * regions->cols; x++) {
+		if (regions->parent[x] < 0) {
+			continue;
+		}
+
+		// No more unions happen, so the roots are final
+		int root = find(regions->parent, x);
+		regions->parent[x] = root;
+		count += root == x;
+	}
+
+	regions->band_count[id] = count;
+}
+
+void regions_number_band(ms_regions *regions, int id, int start, int end) {
+	int offset = 0, total = 0;
+
+	for (int i = 0; i < regions->num_threads; i++) {
+		offset += i < id ? regions->band_count[i] : 0;
+		total += regions->band_count[i];
+	}
+
+	if (id == 0) {
+		regions->count = total;
+	}
+
+	for (int x = start * regions->cols; x < end * regions->cols; x++) {
+		if (regions->parent[x] != x) {
+			continue;
+		}
+
+		regions->label[x] = offset;
+
+		ms_region *region = &regions->regions[offset];
+		region->area = 0;
+		region->perimeter = 0;
+		region->min_row = INT_MAX;
+		region->min_col = INT_MAX;
+		region->max_row = -1;
+		region->max_col = -1;
+		offset++;
+	}
+}
+
+// Atomic minimum / maximum of the bounding box coordinates
+static void atomic_min(int *target, int value) {
+	int current = __atomic_load_n(target, __ATOMIC_RELAXED);
+	while (value < current && !__atomic_compare_exchange_n(target, &current, value, 1,
+														   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+static void atomic_max(int *target, int value) {
+	int current = __atomic_load_n(target, __ATOMIC_RELAXED);
+	while (value > current && !__atomic_compare_exchange_n(target, &current, value, 1,
+														   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+// Whether the grid point (i, j) belongs to a region; points outside the grid do not
+static int foreground(ms_regions *regions, int i, int j) {
+	if (i < 0 || j < 0 || i >= regions->rows || j >= regions->cols) {
+		return 0;
+	}
+	return regions->parent[i * regions->cols + j] >= 0;
+}
+
+void regions_measure_band(ms_regions *regions, int start, int end) {
+	int cols = regions->cols;
+
+	for (int i = start; i < end; i++) {
+		// Regions usually continue along the row, so the updates of a run are merged
+		int current = -1, area = 0, perimeter = 0, min_col = 0, max_col = 0;
+
+		for (int j = 0; j <= cols; j++) {
+			int label = j < cols && regions->parent[i * cols + j] >= 0 ?
+						regions->label[regions->parent[i * cols + j]] : -1;
+
+			if (label != current && current >= 0) {
+				ms_region *region = &regions->regions[current];
+				__atomic_fetch_add(&region->area, area, __ATOMIC_RELAXED);
+				__atomic_fetch_add(&region->perimeter, perimeter, __ATOMIC_RELAXED);
+				atomic_min(&region->min_row, i);
+				atomic_max(&region->max_row, i);
+				atomic_min(&region->min_col, min_col);
+				atomic_max(&region->max_col, max_col);
+			}
+
+			if (label < 0) {
+				current = -1;
+				continue;
+			}
+
+			if (label != current) {
+				current = label;
+				area = 0;
+				perimeter = 0;
+				min_col = j;
+			}
+
+			area++;
+			max_col = j;
+			perimeter += !foreground(regions, i - 1, j) + !foreground(regions, i + 1, j) +
+						 !foreground(regions, i, j - 1) + !foreground(regions, i, j + 1);
+		}
+	}
+}
+
+int ms_regions_write_csv(ms_regions *regions, const char *filename) {
+	FILE *fp = strcmp(filename, "-") ? fopen(filename, "w") : stdout;
+	if (!fp) {
+		fprintf(stderr, "Unable to open file '%s'\n", filename);
+		return -1;
+	}
+
+	fprintf(fp, "region,area,perimeter,min_row,min_col,max_row,max_col\n");
+	for (int i = 0; i < regions->count; i++) {
+		ms_region *region = &regions->regions[i];
+		fprintf(fp, "%d,%d,%d,%d,%d,%d,%d\n", i, region->area, region->perimeter,
+				region->min_row, region->min_col, region->max_row, region->max_col);
+	}
+
+	if (fp != stdout) {
+		fclose(fp);
+	}
+
+	return 0;
+}
@@ -0,0 +1,42 @@
+// Connected-component labeling of the sample grid of the marching squares pipeline
+
+#ifndef REGIONS_H
+#define REGIONS_H
+
+// Foreground region of the grid (4-connected points below the `sigma` threshold).
+// Coordinates are grid rows / columns, which are STEP pixels apart on the image.
+typedef struct {
+    int area;                       // Number of grid points
+    int perimeter;                  // Point sides facing the background or the border
+    int min_row, min_col;           // Bounding box, inclusive
+    int max_row, max_col;
+} ms_region;
+
+// Labels and regions of the last job, sized for the largest grid of the pipeline.
+// Regions are numbered in raster order of their first point.
+typedef struct {
+    int rows, cols;                 // Size of the labeled grid
+    int count;                      // Number of regions
+    int *parent;                    // Union-find forest over the grid points, -1 for background
+    int *label;                     // Region of every root, -1 for background
+    int *band_count;                // Roots found by each thread
+    ms_region *regions;
+    int num_threads;
+} ms_regions;
+
+ms_regions *ms_regions_create(int num_threads);
+void ms_regions_destroy(ms_regions *regions);
+
+// Writes one CSV line per region; "-" writes to stdout. Returns 0 on success.
+int ms_regions_write_csv(ms_regions *regions, const char *filename);
+
+// Steps of the parallel labeling, run by thread `id` on grid rows [start, end) with a
+// barrier between consecutive steps: label the band, merge it with the band above,
+// point every point at its root, number the regions and measure them.
+void regions_label_band(ms_regions *regions, unsigned char **grid, int start, int end);
+void regions_merge_band(ms_regions *regions, unsigned char **grid, int start, int end);
+void regions_flatten_band(ms_regions *regions, int id, int start, int end);
+void regions_number_band(ms_regions *regions, int id, int start, int end);
+void regions_measure_band(ms_regions *regions, int start, int end);
+
+#endif
@@ -0,0 +1,12 @@
+// Cropped reading of P6 images, for contouring a region of interest
+
+#ifndef ROI_H
+#define ROI_H
+
+#include "helpers.h"
+
+// Reads the `w` x `h` rectangle at column `x`, row `y` of a P6 image, reading only the
+// bytes of the rectangle from the file. Exits on errors, like read_ppm().
+ppm_image *read_ppm_roi(const char *filename, int x, int y, int w, int h);
+
+#endif
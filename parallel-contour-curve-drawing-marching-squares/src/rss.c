@@ -0,0 +1,75 @@
+// Resident set size sampling, for the memory report of tema1_par
+
+#include "rss.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+
+struct ms_rss_monitor {
+	pthread_t thread;
+	int interval_ms;
+	int stop;
+	long long total_kb;				// Sum of the samples
+	long samples;
+};
+
+// Current resident set size of the process, in KiB, read from /proc/self/statm
+static long current_rss_kb(void) {
+	long size, resident;
+
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (!fp) {
+		return 0;
+	}
+	if (fscanf(fp, "%ld %ld", &size, &resident) != 2) {
+		resident = 0;
+	}
+	fclose(fp);
+
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void *sample_loop(void *arg) {
+	ms_rss_monitor *monitor = (ms_rss_monitor *)arg;
+	struct timespec interval = { monitor->interval_ms / 1000,
+								 (monitor->interval_ms % 1000) * 1000000L };
+
+	while (!__atomic_load_n(&monitor->stop, __ATOMIC_ACQUIRE)) {
+		monitor->total_kb += current_rss_kb();
+		monitor->samples++;
+		nanosleep(&interval, NULL);
+	}
+
+	return NULL;
+}
+
+ms_rss_monitor *ms_rss_start(int interval_ms) {
+	ms_rss_monitor *monitor = (ms_rss_monitor *)calloc(1, sizeof(ms_rss_monitor));
+	if (!monitor) {
+		return NULL;
+	}
+
+	monitor->interval_ms = interval_ms > 0 ? interval_ms : 1;
+	if (pthread_create(&monitor->thread, NULL, sample_loop, monitor)) {
+		free(monitor);
+		return NULL;
+	}
+
+	return monitor;
+}
+
+void ms_rss_stop(ms_rss_monitor *monitor, long *peak_kb, long *average_kb) {
+	__atomic_store_n(&monitor->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(monitor->thread, NULL);
+
+	// The kernel keeps the exact peak, which sampling could miss
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	*peak_kb = usage.ru_maxrss;
+	*average_kb = monitor->samples ? monitor->total_kb / monitor->samples : current_rss_kb();
+
+	free(monitor);
+}
@@ -0,0 +1,16 @@
+// Resident set size sampling, for the memory report of tema1_par
+
+#ifndef RSS_H
+#define RSS_H
+
+typedef struct ms_rss_monitor ms_rss_monitor;
+
+// Starts a thread that samples the resident set size of the process every `interval_ms`
+// milliseconds. Returns NULL on failure.
+ms_rss_monitor *ms_rss_start(int interval_ms);
+
+// Stops the sampling and returns the peak resident set size of the process and the
+// average of the samples, in KiB
+void ms_rss_stop(ms_rss_monitor *monitor, long *peak_kb, long *average_kb);
+
+#endif
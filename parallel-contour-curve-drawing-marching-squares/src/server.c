@@ -0,0 +1,723 @@
+// Unix domain socket service built on top of libmarching
+
+#define _GNU_SOURCE
+#include "server.h"
+#include "marching.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+
+// Largest accepted input, in pixels
+#define MAX_REQUEST_PIXELS      (1L << 28)
+
+// Bounded queue of accepted connections, filled by the main thread and
+// drained by the workers
+typedef struct {
+	int fds[MS_QUEUE_SIZE];
+	int head, tail, count;
+	int closed;
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+} ConnectionQueue;
+
+// Ring of the latest request latencies, in milliseconds
+typedef struct {
+	double samples[MS_LATENCY_SAMPLES];
+	long count;
+	pthread_mutex_t mutex;
+} LatencyStats;
+
+// State of a connection handler; the buffers are reused across requests
+typedef struct {
+	ms_context* ctx;
+	ConnectionQueue* queue;
+	LatencyStats* stats;
+	int idle_fd;				// Write end of the pipe that hands connections back
+	ppm_pixel* in_buf;
+	size_t in_cap;
+	ppm_image out;
+} Worker;
+
+static volatile sig_atomic_t stop;
+
+static void handle_signal(int sig) {
+	(void)sig;
+	stop = 1;
+}
+
+static double now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void queue_push(ConnectionQueue *queue, int fd) {
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->count == MS_QUEUE_SIZE) {
+		pthread_cond_wait(&queue->not_full, &queue->mutex);
+	}
+
+	queue->fds[queue->tail] = fd;
+	queue->tail = (queue->tail + 1) % MS_QUEUE_SIZE;
+	queue->count++;
+
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+// Returns the next connection, or -1 once the queue is closed and empty
+static int queue_pop(ConnectionQueue *queue) {
+	int fd = -1;
+
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->count == 0 && !queue->closed) {
+		pthread_cond_wait(&queue->not_empty, &queue->mutex);
+	}
+
+	if (queue->count > 0) {
+		fd = queue->fds[queue->head];
+		queue->head = (queue->head + 1) % MS_QUEUE_SIZE;
+		queue->count--;
+		pthread_cond_signal(&queue->not_full);
+	}
+	pthread_mutex_unlock(&queue->mutex);
+
+	return fd;
+}
+
+static void record_latency(LatencyStats *stats, double ms) {
+	pthread_mutex_lock(&stats->mutex);
+	stats->samples[stats->count % MS_LATENCY_SAMPLES] = ms;
+	stats->count++;
+	pthread_mutex_unlock(&stats->mutex);
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double A = *(double *)a;
+	double B = *(double *)b;
+	return (A > B) - (A < B);
+}
+
+// Formats the request count and the latency percentiles of the latest samples
+static int format_stats(LatencyStats *stats, char *buf, size_t size) {
+	static double sorted[MS_LATENCY_SAMPLES];
+	static pthread_mutex_t sorted_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+	pthread_mutex_lock(&sorted_mutex);
+
+	pthread_mutex_lock(&stats->mutex);
+	long count = stats->count;
+	int n = count < MS_LATENCY_SAMPLES ? count : MS_LATENCY_SAMPLES;
+	memcpy(sorted, stats->samples, n * sizeof(double));
+	pthread_mutex_unlock(&stats->mutex);
+
+	qsort(sorted, n, sizeof(double), cmp_double);
+
+	double p50 = n ? sorted[(n - 1) * 50 / 100] : 0;
+	double p90 = n ? sorted[(n - 1) * 90 / 100] : 0;
+	double p99 = n ? sorted[(n - 1) * 99 / 100] : 0;
+	double p999 = n ? sorted[(n - 1) * 999 / 1000] : 0;
+	double max = n ? sorted[n - 1] : 0;
+
+	pthread_mutex_unlock(&sorted_mutex);
+
+	return snprintf(buf, size,
+					"requests %ld\nsamples %d\np50_ms %.3f\np90_ms %.3f\np99_ms %.3f\n"
+					"p999_ms %.3f\nmax_ms %.3f\n", count, n, p50, p90, p99, p999, max);
+}
+
+static int read_full(int fd, void *buf, size_t len) {
+	char *p = buf;
+
+	while (len > 0) {
+		ssize_t r = read(fd, p, len);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			return -1;
+		}
+
+		p += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+	const char *p = buf;
+
+	while (len > 0) {
+		ssize_t r = send(fd, p, len, MSG_NOSIGNAL);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			return -1;
+		}
+
+		p += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+// Receives a header together with the file descriptor attached to it, if any.
+// Returns 1 on success, 0 when the peer closed the connection and -1 on errors.
+static int recv_header(int conn, void *header, size_t len, int *fd) {
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = { .iov_base = header, .iov_len = len };
+	struct msghdr msg = { 0 };
+	ssize_t r;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	*fd = -1;
+	do {
+		r = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+	} while (r < 0 && errno == EINTR);
+
+	if (r <= 0) {
+		return r == 0 ? 0 : -1;
+	}
+
+	for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+		if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+			memcpy(fd, CMSG_DATA(c), sizeof(int));
+		}
+	}
+
+	// The rest of the header may arrive in a separate segment
+	if ((size_t)r < len && read_full(conn, (char *)header + r, len - r)) {
+		return -1;
+	}
+
+	return 1;
+}
+
+// Sends a header, attaching `fd` to it when it is not -1
+static int send_header(int conn, const void *header, size_t len, int fd) {
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = { .iov_base = (void *)header, .iov_len = len };
+	struct msghdr msg = { 0 };
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (fd != -1) {
+		memset(control, 0, sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+		c->cmsg_level = SOL_SOCKET;
+		c->cmsg_type = SCM_RIGHTS;
+		c->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(c), &fd, sizeof(int));
+	}
+
+	ssize_t r;
+	do {
+		r = sendmsg(conn, &msg, MSG_NOSIGNAL);
+	} while (r < 0 && errno == EINTR);
+
+	if (r < 0) {
+		return -1;
+	}
+
+	return write_full(conn, (const char *)header + r, len - r);
+}
+
+static int send_response(int conn, ms_response *res, int fd) {
+	return send_header(conn, res, sizeof(*res), fd);
+}
+
+static int send_error(int conn) {
+	ms_response res = { .status = -1 };
+	return send_response(conn, &res, -1);
+}
+
+// Copies the contour image into a new memfd that is handed over to the client
+static int output_to_memfd(ppm_image *out) {
+	size_t size = (size_t)out->x * out->y * sizeof(ppm_pixel);
+	int fd = memfd_create("contour", MFD_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (ftruncate(fd, size)) {
+		close(fd);
+		return -1;
+	}
+
+	const char *p = (const char *)out->data;
+	size_t off = 0;
+	while (off < size) {
+		ssize_t r = pwrite(fd, p + off, size - off, off);
+		if (r <= 0) {
+			close(fd);
+			return -1;
+		}
+		off += r;
+	}
+
+	return fd;
+}
+
+// Serves one request. Returns 0 if the connection can be reused, -1 otherwise.
+static int handle_request(Worker *w, int conn) {
+	ms_request req;
+	int in_fd;
+
+	int r = recv_header(conn, &req, sizeof(req), &in_fd);
+	if (r <= 0) {
+		return -1;
+	}
+
+	if (req.magic != MS_MAGIC) {
+		if (in_fd != -1) {
+			close(in_fd);
+		}
+		send_error(conn);
+		return -1;
+	}
+
+	if (req.type == MS_REQ_STATS) {
+		char text[512];
+		ms_response res = { 0 };
+		res.length = format_stats(w->stats, text, sizeof(text));
+
+		if (send_response(conn, &res, -1) || write_full(conn, text, res.length)) {
+			return -1;
+		}
+		return 0;
+	}
+
+	double start = now_ms();
+	long pixels = (long)req.width * req.height;
+	size_t size = pixels * sizeof(ppm_pixel);
+
+	if ((req.type != MS_REQ_INLINE && req.type != MS_REQ_MEMFD) || req.width <= 0
+		|| req.height <= 0 || pixels > MAX_REQUEST_PIXELS
+		|| (req.type == MS_REQ_MEMFD) != (in_fd != -1)) {
+		if (in_fd != -1) {
+			close(in_fd);
+		}
+		send_error(conn);
+		return -1;
+	}
+
+	ppm_pixel *in_pixels;
+	void *mapping = MAP_FAILED;
+
+	if (req.type == MS_REQ_INLINE) {
+		// The input buffer only grows, so steady traffic does not allocate
+		if (size > w->in_cap) {
+			ppm_pixel *buf = (ppm_pixel *)realloc(w->in_buf, size);
+			if (!buf) {
+				send_error(conn);
+				return -1;
+			}
+			w->in_buf = buf;
+			w->in_cap = size;
+		}
+
+		if (read_full(conn, w->in_buf, size)) {
+			return -1;
+		}
+		in_pixels = w->in_buf;
+	} else {
+		struct stat st;
+		if (!fstat(in_fd, &st) && (size_t)st.st_size >= size) {
+			mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, in_fd, 0);
+		}
+		close(in_fd);
+
+		if (mapping == MAP_FAILED) {
+			send_error(conn);
+			return 0;
+		}
+		in_pixels = (ppm_pixel *)mapping;
+	}
+
+	int failed = ms_process(w->ctx, in_pixels, req.width, req.height, &w->out);
+
+	if (mapping != MAP_FAILED) {
+		munmap(mapping, size);
+	}
+
+	// The request was read completely, so the connection stays usable
+	if (failed) {
+		return send_error(conn) ? -1 : 0;
+	}
+
+	ms_response res = { 0 };
+	res.width = w->out.x;
+	res.height = w->out.y;
+
+	if (req.type == MS_REQ_INLINE) {
+		res.length = w->out.x * w->out.y * sizeof(ppm_pixel);
+		if (send_response(conn, &res, -1) || write_full(conn, w->out.data, res.length)) {
+			return -1;
+		}
+	} else {
+		int out_fd = output_to_memfd(&w->out);
+		if (out_fd < 0) {
+			send_error(conn);
+			return 0;
+		}
+
+		r = send_response(conn, &res, out_fd);
+		close(out_fd);
+		if (r) {
+			return -1;
+		}
+	}
+
+	record_latency(w->stats, now_ms() - start);
+	return 0;
+}
+
+// Serves one request per queued connection, then hands the connection back to the main
+// thread, which queues it again when the next request arrives. Idle clients therefore
+// never hold a worker.
+static void *worker_function(void *arg) {
+	Worker *w = (Worker *)arg;
+	int conn;
+
+	while ((conn = queue_pop(w->queue)) != -1) {
+		// Writes of at most PIPE_BUF bytes to a pipe are atomic
+		if (handle_request(w, conn) || write(w->idle_fd, &conn, sizeof(conn)) != sizeof(conn)) {
+			close(conn);
+		}
+	}
+
+	return NULL;
+}
+
+// Connections waiting for their next request, polled by the main thread after the
+// listening socket and the pipe of the workers
+typedef struct {
+	struct pollfd *fds;
+	int count, capacity;
+} PollSet;
+
+static void poll_add(PollSet *set, int fd) {
+	if (set->count == set->capacity) {
+		int capacity = set->capacity ? 2 * set->capacity : 64;
+		struct pollfd *fds = (struct pollfd *)realloc(set->fds, capacity * sizeof(struct pollfd));
+		if (!fds) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+		set->fds = fds;
+		set->capacity = capacity;
+	}
+
+	set->fds[set->count].fd = fd;
+	set->fds[set->count].events = POLLIN;
+	set->fds[set->count].revents = 0;
+	set->count++;
+}
+
+int ms_serve(const char *socket_path, int num_workers, int num_threads) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (num_workers < 1 || num_threads < 1 || strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Invalid server configuration\n");
+		return 1;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0) {
+		perror("socket");
+		return 1;
+	}
+
+	// Only a stale socket is replaced; any other file at the path is left alone
+	struct stat st;
+	if (!lstat(socket_path, &st)) {
+		if (!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "'%s' exists and is not a socket\n", socket_path);
+			close(listen_fd);
+			return 1;
+		}
+		unlink(socket_path);
+	}
+
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(listen_fd, SOMAXCONN)) {
+		perror(socket_path);
+		close(listen_fd);
+		return 1;
+	}
+
+	// The workers send the connections they are done with through a pipe
+	int idle_pipe[2];
+	if (pipe2(idle_pipe, O_CLOEXEC)) {
+		perror("pipe");
+		close(listen_fd);
+		return 1;
+	}
+
+	ConnectionQueue queue = { .head = 0 };
+	PollSet idle = { 0 };
+	LatencyStats *stats = (LatencyStats *)calloc(1, sizeof(LatencyStats));
+	Worker *workers = (Worker *)calloc(num_workers, sizeof(Worker));
+	pthread_t tid[num_workers];
+
+	if (!stats || !workers) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	pthread_mutex_init(&queue.mutex, NULL);
+	pthread_cond_init(&queue.not_empty, NULL);
+	pthread_cond_init(&queue.not_full, NULL);
+	pthread_mutex_init(&stats->mutex, NULL);
+
+	// Only the main thread handles the termination signals
+	sigset_t set, old_set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, &old_set);
+
+	// Each worker owns a warm context and an output buffer for the largest contour image
+	for (int i = 0; i < num_workers; i++) {
+		workers[i].ctx = ms_create(num_threads, "./contours");
+		workers[i].out.data = (ppm_pixel *)malloc(RESCALE_X * RESCALE_Y * sizeof(ppm_pixel));
+		workers[i].queue = &queue;
+		workers[i].stats = stats;
+		workers[i].idle_fd = idle_pipe[1];
+
+		if (!workers[i].ctx || !workers[i].out.data) {
+			fprintf(stderr, "Unable to create the marching squares context\n");
+			exit(1);
+		}
+
+		pthread_create(&tid[i], NULL, worker_function, &workers[i]);
+	}
+
+	struct sigaction sa = { .sa_handler = handle_signal };
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+
+	printf("Listening on %s with %d workers x %d threads\n", socket_path, num_workers, num_threads);
+	fflush(stdout);
+
+	poll_add(&idle, listen_fd);
+	poll_add(&idle, idle_pipe[0]);
+
+	while (!stop) {
+		if (poll(idle.fds, idle.count, -1) < 0) {
+			if (errno != EINTR) {
+				perror("poll");
+			}
+			continue;
+		}
+
+		// A connection with a pending request (or a hangup) goes to the workers
+		for (int i = idle.count - 1; i >= 2; i--) {
+			if (idle.fds[i].revents) {
+				queue_push(&queue, idle.fds[i].fd);
+				idle.fds[i] = idle.fds[--idle.count];
+			}
+		}
+
+		if (idle.fds[1].revents & POLLIN) {
+			int conn;
+			if (read(idle_pipe[0], &conn, sizeof(conn)) == sizeof(conn)) {
+				poll_add(&idle, conn);
+			}
+		}
+
+		if (idle.fds[0].revents & POLLIN) {
+			int conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+			if (conn >= 0) {
+				poll_add(&idle, conn);
+			} else if (errno != EINTR) {
+				perror("accept");
+			}
+		}
+	}
+
+	// Let the workers finish the queued requests, then stop them
+	pthread_mutex_lock(&queue.mutex);
+	queue.closed = 1;
+	pthread_cond_broadcast(&queue.not_empty);
+	pthread_mutex_unlock(&queue.mutex);
+
+	// Idle connections are closed without waiting for their clients
+	for (int i = 2; i < idle.count; i++) {
+		close(idle.fds[i].fd);
+	}
+
+	for (int i = 0; i < num_workers; i++) {
+		pthread_join(tid[i], NULL);
+		ms_destroy(workers[i].ctx);
+		free(workers[i].in_buf);
+		free(workers[i].out.data);
+	}
+
+	char text[512];
+	format_stats(stats, text, sizeof(text));
+	printf("%s", text);
+
+	// The connections handed back after the loop ended are still in the pipe
+	close(idle_pipe[1]);
+	int conn;
+	while (read(idle_pipe[0], &conn, sizeof(conn)) == sizeof(conn)) {
+		close(conn);
+	}
+	close(idle_pipe[0]);
+	free(idle.fds);
+
+	close(listen_fd);
+	unlink(socket_path);
+
+	pthread_mutex_destroy(&queue.mutex);
+	pthread_cond_destroy(&queue.not_empty);
+	pthread_cond_destroy(&queue.not_full);
+	pthread_mutex_destroy(&stats->mutex);
+	free(workers);
+	free(stats);
+
+	return 0;
+}
+
+// Maps `size` bytes of a memfd received from the server and copies them into `dst`
+static int read_memfd(int fd, void *dst, size_t size) {
+	void *mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED) {
+		return -1;
+	}
+
+	memcpy(dst, mapping, size);
+	munmap(mapping, size);
+	return 0;
+}
+
+int ms_client(const char *socket_path, int type, const char *in_file, const char *out_file,
+			  int repeat, int idle_ms) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Invalid socket path\n");
+		return 1;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (conn < 0 || connect(conn, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror(socket_path);
+		if (conn >= 0) {
+			close(conn);
+		}
+		return 1;
+	}
+
+	ms_request req = { .magic = MS_MAGIC, .type = type };
+	ms_response res;
+	int fd, failed = 0;
+
+	if (type == MS_REQ_STATS) {
+		char text[512];
+
+		if (send_header(conn, &req, sizeof(req), -1) || recv_header(conn, &res, sizeof(res), &fd) != 1
+			|| res.status || res.length >= sizeof(text) || read_full(conn, text, res.length)) {
+			fprintf(stderr, "Request failed\n");
+			close(conn);
+			return 1;
+		}
+
+		text[res.length] = '\0';
+		printf("%s", text);
+		close(conn);
+		return 0;
+	}
+
+	ppm_image *image = read_ppm(in_file);
+	size_t size = (size_t)image->x * image->y * sizeof(ppm_pixel);
+	req.width = image->x;
+	req.height = image->y;
+
+	// With MS_REQ_MEMFD, the pixels are copied once into a memfd that is sent every time
+	int in_fd = -1;
+	if (type == MS_REQ_MEMFD) {
+		in_fd = memfd_create("image", MFD_CLOEXEC);
+		if (in_fd < 0 || ftruncate(in_fd, size) || pwrite(in_fd, image->data, size, 0) != (ssize_t)size) {
+			perror("memfd");
+			exit(1);
+		}
+	}
+
+	ppm_image out = { 0 };
+	for (int i = 0; i < repeat && !failed; i++) {
+		if (i && idle_ms > 0) {
+			usleep(idle_ms * 1000);
+		}
+
+		if (send_header(conn, &req, sizeof(req), in_fd)
+			|| (type == MS_REQ_INLINE && write_full(conn, image->data, size))
+			|| recv_header(conn, &res, sizeof(res), &fd) != 1 || res.status) {
+			failed = 1;
+			break;
+		}
+
+		size_t out_size = (size_t)res.width * res.height * sizeof(ppm_pixel);
+		if (out_size > (size_t)out.x * out.y * sizeof(ppm_pixel)) {
+			out.data = (ppm_pixel *)realloc(out.data, out_size);
+			if (!out.data) {
+				fprintf(stderr, "Unable to allocate memory\n");
+				exit(1);
+			}
+		}
+		out.x = res.width;
+		out.y = res.height;
+
+		if (type == MS_REQ_INLINE) {
+			failed = res.length != out_size || read_full(conn, out.data, out_size);
+		} else {
+			failed = fd == -1 || read_memfd(fd, out.data, out_size);
+		}
+
+		if (fd != -1) {
+			close(fd);
+		}
+	}
+
+	if (failed) {
+		fprintf(stderr, "Request failed\n");
+	} else {
+		write_ppm(&out, out_file);
+	}
+
+	if (in_fd != -1) {
+		close(in_fd);
+	}
+	close(conn);
+	free(out.data);
+	free(image->data);
+	free(image);
+
+	return failed;
+}
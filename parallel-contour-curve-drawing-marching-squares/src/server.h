@@ -0,0 +1,49 @@
+// Unix domain socket service built on top of libmarching
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+
+#define MS_MAGIC                0x4d534d51
+#define MS_LATENCY_SAMPLES      4096
+#define MS_QUEUE_SIZE           64
+
+// Request types. Every request starts with an `ms_request` header.
+//   MS_REQ_INLINE - the header is followed by width * height * 3 bytes of RGB pixels;
+//                   the contour image is sent back inline after the response header
+//   MS_REQ_MEMFD  - the header carries (SCM_RIGHTS) a memfd holding the pixels;
+//                   the contour image is sent back in a new memfd attached to the response
+//   MS_REQ_STATS  - the response is followed by `length` bytes of text with the
+//                   request count and the latency percentiles
+enum {
+    MS_REQ_INLINE = 0,
+    MS_REQ_MEMFD  = 1,
+    MS_REQ_STATS  = 2,
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t type;
+    int32_t width, height;
+} ms_request;
+
+// `status` is 0 on success; `length` is the number of bytes that follow inline
+typedef struct {
+    int32_t status;
+    int32_t width, height;
+    uint32_t length;
+} ms_response;
+
+// Serves requests on `socket_path` with `num_workers` connection handlers, each owning
+// a context with `num_threads` threads. Returns when SIGINT or SIGTERM is received.
+int ms_serve(const char *socket_path, int num_workers, int num_threads);
+
+// Sends `in_file` `repeat` times over one connection to the server on `socket_path`,
+// waiting `idle_ms` between the requests, and writes the last contour image to
+// `out_file`. A MS_REQ_STATS request prints the statistics of the server instead.
+// Returns 0 on success.
+int ms_client(const char *socket_path, int type, const char *in_file, const char *out_file,
+              int repeat, int idle_ms);
+
+#endif
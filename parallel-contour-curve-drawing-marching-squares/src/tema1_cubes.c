@@ -0,0 +1,580 @@
+// Marching cubes over a stack of numbered PPM / PGM slices, the 3D counterpart of tema1_par
+
+#include "helpers.h"
+#include "pnm.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Find the minimum out of two numbers
+#define min(a, b) a < b ? a : b
+
+// A configuration has at most 12 crossed edges, in loops of at least 3 edges, so its entry
+// has at most 12 edges and 4 loop lengths, and it makes at most 10 triangles
+#define MAX_CASE_ENTRIES		16
+#define MAX_CASE_TRIANGLES		10
+
+// Stack of slices read from `pattern` (a printf() format taking the slice number). Slices
+// are rescaled like the images of tema1_par when they are larger than RESCALE_X x RESCALE_Y,
+// then sampled every `step` pixels. Row r of a slice holds `nx` consecutive grid points.
+typedef struct {
+	const char *pattern;
+	int first;					// Number of the first slice
+	int count;					// Number of slices
+	int sx, sy;					// Size of the slices in the files
+	int rescale;				// Whether the slices are rescaled
+	int X, Y;					// Size of the slices after the rescale
+	int step;
+	int nx, ny;					// Grid points of a slice
+} Volume;
+
+typedef struct {
+	float x, y, z;
+} Vertex;
+
+// Mesh of the cells between slices [z0, z1]. Its vertices start with those of the edges of
+// slice z0 and the edges of slice z1 are the `top_count` vertices at `top_start`, both in
+// raster order, so the first ones of a slab are the last ones of the slab below it.
+typedef struct {
+	int z0, z1;
+	Vertex *vertices;
+	int num_vertices, vertex_capacity;
+	int *faces;					// Three vertices per triangle
+	int num_faces, face_capacity;
+	int bottom_count;			// Vertices of the edges of slice z0
+	int top_start, top_count;	// Vertices of the edges of slice z1
+	int skip;					// Leading vertices that belong to the slab below
+	int offset;					// Index of the first vertex of the slab in the output
+} Slab;
+
+// Structure used to pass data to the thread function
+typedef struct {
+	int id;
+	int num_threads;
+	pthread_barrier_t *barrier;
+	Volume *volume;
+	Slab *slabs;
+} ThreadData;
+
+// Loops of every configuration of the 8 corners of a cell (bit c is set when corner c is
+// inside): the length of each loop followed by its edges, terminated by 0. Each loop is
+// fanned from its first edge. Corner c is at (c & 1, c >> 1 & 1, c >> 2) and edge 4 * d + k
+// is parallel to axis d, at the position k of the other two axes.
+static signed char case_table[256][MAX_CASE_ENTRIES + 1];
+
+// Edge between two corners that differ along a single axis
+static int edge_of(int c1, int c2) {
+	int d = __builtin_ctz(c1 ^ c2);
+	int base = c1 & c2;
+	int lo = d == 0 ? 1 : 0;
+	int hi = d == 2 ? 1 : 2;
+
+	return 4 * d + (((base >> lo) & 1) | (((base >> hi) & 1) << 1));
+}
+
+// Faces of the cell that hold edge `e`, as a mask where face 2 * d + s is at position s of
+// axis d
+static int faces_of(int e) {
+	int d = e / 4, k = e % 4;
+	int lo = d == 0 ? 1 : 0;
+	int hi = d == 2 ? 1 : 2;
+
+	return 1 << (2 * lo + (k & 1)) | 1 << (2 * hi + (k >> 1));
+}
+
+// Position of a loop vertex that shares no face with the vertices it is not next to, so
+// that no diagonal of its fan lies on a face of the cell, or -1 if there is none
+static int fan_apex(const int *loop, int length) {
+	for (int a = 0; a < length; a++) {
+		int ok = 1;
+
+		for (int j = 2; j + 1 < length && ok; j++) {
+			ok = !(faces_of(loop[a]) & faces_of(loop[(a + j) % length]));
+		}
+		if (ok) {
+			return a;
+		}
+	}
+
+	return -1;
+}
+
+// Builds the case table. On every face of the cell, walked counter-clockwise as seen from
+// outside, a segment joins the edge where the walk leaves each run of inside corners to the
+// edge where it entered the run. Diagonal faces thus always separate the inside corners,
+// and since the segments only depend on the face, neighboring cells agree on them and the
+// surface is closed. Every crossed edge ends the segment of one face and starts the segment
+// of the other, so the segments form loops. A diagonal between two vertices of the same face
+// would lie on the face, where the neighboring cell can make the same triangle with the
+// opposite winding, so each loop is fanned from a vertex that has no such diagonal (every
+// loop of the 256 cases has one).
+static void init_case_table(void) {
+	static const int us[4] = { 0, 1, 1, 0 };
+	static const int vs[4] = { 0, 0, 1, 1 };
+
+	for (int config = 0; config < 256; config++) {
+		int next[12], visited[12] = { 0 }, n = 0;
+		memset(next, -1, sizeof(next));
+
+		for (int a = 0; a < 3; a++) {
+			for (int s = 0; s < 2; s++) {
+				int corner[4], in[4];
+
+				for (int k = 0; k < 4; k++) {
+					int kk = s ? k : 3 - k;
+					corner[k] = s << a | us[kk] << (a + 1) % 3 | vs[kk] << (a + 2) % 3;
+					in[k] = config >> corner[k] & 1;
+				}
+
+				for (int k = 0; k < 4; k++) {
+					if (!in[k] || in[(k + 1) % 4]) {
+						continue;
+					}
+
+					int j = k;
+					while (in[(j + 3) % 4]) {
+						j = (j + 3) % 4;
+					}
+					next[edge_of(corner[k], corner[(k + 1) % 4])] =
+						edge_of(corner[(j + 3) % 4], corner[j]);
+				}
+			}
+		}
+
+		for (int e = 0; e < 12; e++) {
+			if (next[e] < 0 || visited[e]) {
+				continue;
+			}
+
+			int loop[12], length = 0;
+			for (int f = e; !visited[f]; f = next[f]) {
+				visited[f] = 1;
+				loop[length++] = f;
+			}
+
+			int apex = fan_apex(loop, length);
+			if (apex < 0) {
+				fprintf(stderr, "Case %d has a loop without a fan apex\n", config);
+				exit(1);
+			}
+
+			case_table[config][n++] = length;
+			for (int i = 0; i < length; i++) {
+				case_table[config][n++] = loop[(apex + i) % length];
+			}
+		}
+
+		case_table[config][n] = 0;
+	}
+}
+
+static void *grow(void *array, int *capacity, int needed, size_t size) {
+	if (needed <= *capacity) {
+		return array;
+	}
+
+	*capacity = needed > 2 * *capacity ? needed : 2 * *capacity;
+	array = realloc(array, *capacity * size);
+	if (!array) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	return array;
+}
+
+// Adds the vertex of the edge between the points `a` and `b` units along axis `axis` from
+// (x, y, z) when the threshold crosses it, and returns it (-1 otherwise). Points at or below
+// SIGMA are inside, as the points set in the grid of tema1_par.
+static int add_vertex(Slab *slab, Volume *volume, int x, int y, int z, int axis,
+					  unsigned char a, unsigned char b) {
+	if ((a <= SIGMA) == (b <= SIGMA)) {
+		return -1;
+	}
+
+	// The crossing sits between SIGMA and SIGMA + 1, so it is never on a grid point
+	float t = (SIGMA + 0.5f - a) / (float)(b - a);
+
+	slab->vertices = (Vertex *)grow(slab->vertices, &slab->vertex_capacity,
+									slab->num_vertices + 1, sizeof(Vertex));
+	Vertex *v = &slab->vertices[slab->num_vertices];
+	v->x = (x + (axis == 0 ? t : 0)) * volume->step;
+	v->y = (y + (axis == 1 ? t : 0)) * volume->step;
+	v->z = z + (axis == 2 ? t : 0);
+
+	return slab->num_vertices++;
+}
+
+// Reads slice `z` into its grid of gray levels
+static void load_slice(Volume *volume, int z, unsigned char *values) {
+	char filename[FILENAME_MAX_SIZE + 256];
+	snprintf(filename, sizeof(filename), volume->pattern, volume->first + z);
+
+	pnm_image *slice = read_pnm(filename, 1);
+	if (slice->x != volume->sx || slice->y != volume->sy) {
+		fprintf(stderr, "Slice '%s' is not %dx%d\n", filename, volume->sx, volume->sy);
+		exit(1);
+	}
+
+	ppm_image image = { slice->x, slice->y, slice->data };
+	if (volume->rescale && !slice->data) {
+		// sample_bicubic() reads RGB pixels, so gray slices are widened first
+		image.data = (ppm_pixel *)malloc((size_t)slice->x * slice->y * sizeof(ppm_pixel));
+		if (!image.data) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+		for (size_t k = 0; k < (size_t)slice->x * slice->y; k++) {
+			image.data[k].red = slice->gray[k];
+			image.data[k].green = slice->gray[k];
+			image.data[k].blue = slice->gray[k];
+		}
+	}
+
+	for (int r = 0; r < volume->ny; r++) {
+		for (int c = 0; c < volume->nx; c++) {
+			int x = c * volume->step, y = r * volume->step;
+			uint8_t sample[3];
+
+			if (volume->rescale) {
+				float u = (float)x / (float)(volume->X - 1);
+				float v = (float)y / (float)(volume->Y - 1);
+				sample_bicubic(&image, u, v, sample);
+			} else if (slice->data) {
+				ppm_pixel pixel = slice->data[(size_t)y * slice->x + x];
+				sample[0] = pixel.red;
+				sample[1] = pixel.green;
+				sample[2] = pixel.blue;
+			} else {
+				sample[0] = sample[1] = sample[2] = slice->gray[(size_t)y * slice->x + x];
+			}
+
+			values[r * volume->nx + c] = (sample[0] + sample[1] + sample[2]) / 3;
+		}
+	}
+
+	if (image.data != slice->data) {
+		free(image.data);
+	}
+	free_pnm(slice);
+}
+
+// Adds the vertices of the edges of slice z, in raster order: the edges along x of a row,
+// then the edges along y to the next row
+static void slice_vertices(Slab *slab, Volume *volume, int z, unsigned char *values,
+						   int *x_edges, int *y_edges) {
+	int nx = volume->nx, ny = volume->ny;
+
+	for (int r = 0; r < ny; r++) {
+		for (int c = 0; c + 1 < nx; c++) {
+			x_edges[r * (nx - 1) + c] = add_vertex(slab, volume, c, r, z, 0,
+												   values[r * nx + c], values[r * nx + c + 1]);
+		}
+
+		for (int c = 0; r + 1 < ny && c < nx; c++) {
+			y_edges[r * nx + c] = add_vertex(slab, volume, c, r, z, 1,
+											 values[r * nx + c], values[(r + 1) * nx + c]);
+		}
+	}
+}
+
+// Triangulates the cells between slices z and z + 1
+static void march_layer(Slab *slab, Volume *volume, unsigned char *values[2],
+						int *x_edges[2], int *y_edges[2], int *z_edges) {
+	int nx = volume->nx, ny = volume->ny;
+
+	for (int r = 0; r + 1 < ny; r++) {
+		for (int c = 0; c + 1 < nx; c++) {
+			int config = 0;
+			for (int k = 0; k < 8; k++) {
+				int dx = k & 1, dy = k >> 1 & 1, dz = k >> 2;
+				config |= (values[dz][(r + dy) * nx + c + dx] <= SIGMA) << k;
+			}
+
+			signed char *entry = case_table[config];
+			slab->faces = (int *)grow(slab->faces, &slab->face_capacity,
+									  3 * (slab->num_faces + MAX_CASE_TRIANGLES), sizeof(int));
+
+			while (*entry) {
+				int length = *entry, loop[12];
+
+				for (int i = 0; i < length; i++) {
+					int d = entry[1 + i] / 4, k = entry[1 + i] % 4;
+
+					if (d == 0) {
+						loop[i] = x_edges[k >> 1][(r + (k & 1)) * (nx - 1) + c];
+					} else if (d == 1) {
+						loop[i] = y_edges[k >> 1][r * nx + c + (k & 1)];
+					} else {
+						loop[i] = z_edges[(r + (k >> 1)) * nx + c + (k & 1)];
+					}
+				}
+
+				int *face = &slab->faces[3 * slab->num_faces];
+				for (int i = 1; i + 1 < length; i++) {
+					*face++ = loop[0];
+					*face++ = loop[i + 1];
+					*face++ = loop[i];
+				}
+				slab->num_faces += length - 2;
+
+				entry += 1 + length;
+			}
+		}
+	}
+}
+
+// Builds the mesh of a slab, holding two slices at a time
+static void march_slab(Slab *slab, Volume *volume) {
+	int nx = volume->nx, ny = volume->ny;
+	unsigned char *values[2];
+	int *x_edges[2], *y_edges[2];
+
+	int *z_edges = (int *)malloc((size_t)nx * ny * sizeof(int));
+	for (int i = 0; i < 2; i++) {
+		values[i] = (unsigned char *)malloc((size_t)nx * ny);
+		x_edges[i] = (int *)malloc((size_t)(nx - 1) * ny * sizeof(int));
+		y_edges[i] = (int *)malloc((size_t)nx * (ny - 1) * sizeof(int));
+		if (!values[i] || !x_edges[i] || !y_edges[i] || !z_edges) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+	}
+
+	load_slice(volume, slab->z0, values[0]);
+	slice_vertices(slab, volume, slab->z0, values[0], x_edges[0], y_edges[0]);
+	slab->bottom_count = slab->num_vertices;
+
+	for (int z = slab->z0; z < slab->z1; z++) {
+		load_slice(volume, z + 1, values[1]);
+		slab->top_start = slab->num_vertices;
+		slice_vertices(slab, volume, z + 1, values[1], x_edges[1], y_edges[1]);
+		slab->top_count = slab->num_vertices - slab->top_start;
+
+		for (int k = 0; k < nx * ny; k++) {
+			z_edges[k] = add_vertex(slab, volume, k % nx, k / nx, z, 2, values[0][k], values[1][k]);
+		}
+
+		march_layer(slab, volume, values, x_edges, y_edges, z_edges);
+
+		// The top slice is the bottom one of the next layer
+		unsigned char *v = values[0];
+		values[0] = values[1];
+		values[1] = v;
+		int *t = x_edges[0];
+		x_edges[0] = x_edges[1];
+		x_edges[1] = t;
+		t = y_edges[0];
+		y_edges[0] = y_edges[1];
+		y_edges[1] = t;
+	}
+
+	free(z_edges);
+	for (int i = 0; i < 2; i++) {
+		free(values[i]);
+		free(x_edges[i]);
+		free(y_edges[i]);
+	}
+}
+
+// Vertices of a slab that are not shared with the slab below it
+static int own_vertices(Slab *slabs, int k) {
+	return slabs[k].num_vertices - (k ? slabs[k].bottom_count : 0);
+}
+
+static void *thread_function(void *arg) {
+	ThreadData *data = (ThreadData *)arg;
+	Slab *slabs = data->slabs;
+	int k = data->id;
+	Slab *slab = &slabs[k];
+
+	march_slab(slab, data->volume);
+	pthread_barrier_wait(data->barrier);
+
+	// The vertices of slice z0 were also made by the slab below, in the same order, so they
+	// are replaced by those and left out of the output
+	slab->skip = k ? slab->bottom_count : 0;
+	slab->offset = 0;
+	for (int i = 0; i < k; i++) {
+		slab->offset += own_vertices(slabs, i);
+	}
+
+	if (k && slabs[k - 1].top_count != slab->bottom_count) {
+		fprintf(stderr, "Slabs %d and %d do not match\n", k - 1, k);
+		exit(1);
+	}
+
+	// First output vertex of the top slice of the slab below
+	int shared = 0;
+	if (k) {
+		shared = slab->offset - own_vertices(slabs, k - 1) + slabs[k - 1].top_start -
+				 (k > 1 ? slabs[k - 1].bottom_count : 0);
+	}
+
+	for (int i = 0; i < 3 * slab->num_faces; i++) {
+		int v = slab->faces[i];
+		slab->faces[i] = v < slab->skip ? shared + v : slab->offset + v - slab->skip;
+	}
+
+	return NULL;
+}
+
+// Writes the meshes of the slabs as a single binary PLY file
+static void write_ply(Slab *slabs, int num_slabs, const char *filename) {
+	FILE *fp = fopen(filename, "wb");
+	if (!fp) {
+		fprintf(stderr, "Unable to open file '%s'\n", filename);
+		exit(1);
+	}
+
+	long num_vertices = 0, num_faces = 0;
+	for (int k = 0; k < num_slabs; k++) {
+		num_vertices += own_vertices(slabs, k);
+		num_faces += slabs[k].num_faces;
+	}
+
+	fprintf(fp, "ply\nformat binary_little_endian 1.0\ncomment tema1_cubes, threshold %d\n"
+			"element vertex %ld\nproperty float x\nproperty float y\nproperty float z\n"
+			"element face %ld\nproperty list uchar int vertex_indices\nend_header\n",
+			SIGMA, num_vertices, num_faces);
+
+	for (int k = 0; k < num_slabs; k++) {
+		fwrite(&slabs[k].vertices[slabs[k].skip], sizeof(Vertex), own_vertices(slabs, k), fp);
+	}
+
+	for (int k = 0; k < num_slabs; k++) {
+		for (int f = 0; f < slabs[k].num_faces; f++) {
+			fputc(3, fp);
+			fwrite(&slabs[k].faces[3 * f], sizeof(int), 3, fp);
+		}
+	}
+
+	fclose(fp);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 5) {
+		fprintf(stderr, "Usage: ./tema1_cubes <slice_pattern> <num_slices> <out_file> <P> "
+				"[--first <index>] [--step <S>] [--time]\n");
+		return 1;
+	}
+
+	Volume volume;
+	memset(&volume, 0, sizeof(volume));
+	volume.pattern = argv[1];
+	volume.count = atoi(argv[2]);
+	volume.step = 1;
+
+	// Get the threads number
+	int num_threads = atoi(argv[4]);
+
+	// Parse the optional arguments
+	int print_time = 0;
+	for (int i = 5; i < argc; i++) {
+		if (!strcmp(argv[i], "--first") && i + 1 < argc) {
+			volume.first = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--step") && i + 1 < argc) {
+			volume.step = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--time")) {
+			print_time = 1;
+		} else {
+			fprintf(stderr, "Unknown argument '%s'\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (volume.count < 2 || volume.step < 1 || num_threads < 1) {
+		fprintf(stderr, "The volume needs at least 2 slices, a positive step and threads\n");
+		return 1;
+	}
+
+	char filename[FILENAME_MAX_SIZE + 256];
+	snprintf(filename, sizeof(filename), volume.pattern, volume.first);
+	if (read_pnm_size(filename, &volume.sx, &volume.sy)) {
+		fprintf(stderr, "Unable to read the size of '%s'\n", filename);
+		return 1;
+	}
+
+	// We only rescale downwards
+	volume.rescale = volume.sx > RESCALE_X || volume.sy > RESCALE_Y;
+	volume.X = volume.rescale ? RESCALE_X : volume.sx;
+	volume.Y = volume.rescale ? RESCALE_Y : volume.sy;
+	volume.nx = (volume.X - 1) / volume.step + 1;
+	volume.ny = (volume.Y - 1) / volume.step + 1;
+	if (volume.nx < 2 || volume.ny < 2) {
+		fprintf(stderr, "The slices need at least 2x2 grid points\n");
+		return 1;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	init_case_table();
+
+	// Every thread marches a slab of consecutive layers of cells
+	int layers = volume.count - 1;
+	num_threads = min(num_threads, layers);
+
+	pthread_t *threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+	ThreadData *data = (ThreadData *)malloc(num_threads * sizeof(ThreadData));
+	Slab *slabs = (Slab *)calloc(num_threads, sizeof(Slab));
+	pthread_barrier_t barrier;
+	if (!threads || !data || !slabs) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	pthread_barrier_init(&barrier, NULL, num_threads);
+
+	for (int i = 0; i < num_threads; i++) {
+		slabs[i].z0 = i * (double)layers / num_threads;
+		slabs[i].z1 = min((i + 1) * (double)layers / num_threads, layers);
+
+		data[i].id = i;
+		data[i].num_threads = num_threads;
+		data[i].barrier = &barrier;
+		data[i].volume = &volume;
+		data[i].slabs = slabs;
+
+		if (pthread_create(&threads[i], NULL, thread_function, &data[i])) {
+			fprintf(stderr, "Error creating thread %d\n", i);
+			exit(-1);
+		}
+	}
+
+	for (int i = 0; i < num_threads; i++) {
+		if (pthread_join(threads[i], NULL)) {
+			fprintf(stderr, "Error waiting for thread %d\n", i);
+			exit(-1);
+		}
+	}
+
+	write_ply(slabs, num_threads, argv[3]);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (print_time) {
+		long num_vertices = 0, num_faces = 0;
+		for (int k = 0; k < num_threads; k++) {
+			num_vertices += own_vertices(slabs, k);
+			num_faces += slabs[k].num_faces;
+		}
+
+		printf("Extracted %ld vertices and %ld triangles from %d slices with %d threads in %.3f ms\n",
+			   num_vertices, num_faces, volume.count, num_threads,
+			   (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+	}
+
+	// Free the resources
+	pthread_barrier_destroy(&barrier);
+	for (int i = 0; i < num_threads; i++) {
+		free(slabs[i].vertices);
+		free(slabs[i].faces);
+	}
+	free(slabs);
+	free(threads);
+	free(data);
+
+	return 0;
+}
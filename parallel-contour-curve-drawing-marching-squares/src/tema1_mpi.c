@@ -0,0 +1,701 @@
+// Distributed marching squares: every MPI process contours a band of rows
+
+#define _GNU_SOURCE
+#include "helpers.h"
+#include <mpi.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MASTER 0
+
+#define CLAMP(v, min, max) if(v < min) { v = min; } else if(v > max) { v = max; }
+
+// Find the minimum out of two numbers
+#define min(a, b) a < b ? a : b
+
+// Band of the contour image handled by one process. As in the shared memory version,
+// row i of an image holds `Y` consecutive pixels, and output row i is interpolated from
+// the source pixels around x = i * sx / (X - 1) on every source row y, so the band of
+// output rows needs a band of source columns (plus the bicubic halo) from every row.
+typedef struct {
+	int X, Y;					// Size of the contour image
+	int sx, sy;					// Size of the source image
+	int rescale;				// Whether the source image is rescaled
+	int p, q;					// Size of the grid
+	int g0, g1;					// Grid cells rows [g0, g1) marched by the process
+	int r0, r1;					// Image rows [r0, r1) owned by the process
+	int cx0, cx1;				// Source columns [cx0, cx1) needed to rescale the band
+	ppm_pixel *source;			// (cx1 - cx0) x sy source pixels, row-major
+	ppm_pixel *rows;			// Image rows [r0, r1)
+	unsigned char **grid;		// Grid rows [g0, g1], q + 1 values each
+	unsigned char *last_column;	// Grid column q, for the images that are not rescaled
+} Band;
+
+// Arguments of the threads that share the band of a process, as in the shared memory version
+typedef struct {
+	int id;
+	int num_threads;
+	pthread_barrier_t *barrier;
+	Band *band;
+	ppm_image **contour_map;
+	int rank, num_procs;
+	MPI_Request *halo;			// Grid row exchange, posted and completed by thread 0
+} ThreadData;
+
+// Bicubic sample position of output row `i`, computed exactly as in sample_bicubic()
+static int source_column(int i, int X, int sx) {
+	float u = (float)i / (float)(X - 1);
+	float x = (u * sx) - 0.5;
+	return (int)x;
+}
+
+// Computes the rows, grid cells and source columns of the band of `rank`
+static void compute_band(Band *band, int rank, int num_procs) {
+	band->g0 = rank * (double)band->p / num_procs;
+	band->g1 = min((rank + 1) * (double)band->p / num_procs, band->p);
+
+	// The last process also keeps the rows below the last grid cell
+	band->r0 = band->g0 * STEP;
+	band->r1 = rank == num_procs - 1 ? band->X : band->g1 * STEP;
+
+	band->cx0 = 0;
+	band->cx1 = 0;
+	if (band->rescale) {
+		int first = source_column(band->r0, band->X, band->sx) - 1;
+		int last = source_column(band->r1 - 1, band->X, band->sx) + 2;
+		CLAMP(first, 0, band->sx - 1);
+		CLAMP(last, 0, band->sx - 1);
+		band->cx0 = first;
+		band->cx1 = last + 1;
+	}
+}
+
+// Same as get_pixel_clamped(), for a band of source columns
+static void get_band_pixel(Band *band, int x, int y, uint8_t temp[]) {
+	CLAMP(x, 0, band->sx - 1);
+	CLAMP(y, 0, band->sy - 1);
+
+	ppm_pixel *pixel = &band->source[x - band->cx0 + (band->cx1 - band->cx0) * y];
+	temp[0] = pixel->red;
+	temp[1] = pixel->green;
+	temp[2] = pixel->blue;
+}
+
+// Same as sample_bicubic(), for a band of source columns
+static void sample_bicubic_band(Band *band, float u, float v, uint8_t sample[]) {
+	float x = (u * band->sx) - 0.5;
+	int xint = (int)x;
+	float xfract = x - floor(x);
+
+	float y = (v * band->sy) - 0.5;
+	int yint = (int)y;
+	float yfract = y - floor(y);
+
+	uint8_t p[4][4][3];
+	for (int r = 0; r < 4; r++) {
+		for (int c = 0; c < 4; c++) {
+			get_band_pixel(band, xint - 1 + c, yint - 1 + r, p[r][c]);
+		}
+	}
+
+	// interpolate bi-cubically
+	for (int i = 0; i < 3; i++) {
+		float col0 = cubic_hermite(p[0][0][i], p[0][1][i], p[0][2][i], p[0][3][i], xfract);
+		float col1 = cubic_hermite(p[1][0][i], p[1][1][i], p[1][2][i], p[1][3][i], xfract);
+		float col2 = cubic_hermite(p[2][0][i], p[2][1][i], p[2][2][i], p[2][3][i], xfract);
+		float col3 = cubic_hermite(p[3][0][i], p[3][1][i], p[3][2][i], p[3][3][i], xfract);
+
+		float value = cubic_hermite(col0, col1, col2, col3, yfract);
+
+		CLAMP(value, 0.0f, 255.0f);
+
+		sample[i] = (uint8_t)value;
+	}
+}
+
+// Rescale rows [start, end) of the band to 2048x2048 using bicubic interpolation
+static void rescale_band(Band *band, int start, int end) {
+	uint8_t sample[3];
+
+	for (int i = start; i < end; i++) {
+		for (int j = 0; j < band->Y; j++) {
+			float u = (float)i / (float)(band->X - 1);
+			float v = (float)j / (float)(band->Y - 1);
+			sample_bicubic_band(band, u, v, sample);
+
+			ppm_pixel *pixel = &band->rows[(i - band->r0) * band->Y + j];
+			pixel->red = sample[0];
+			pixel->green = sample[1];
+			pixel->blue = sample[2];
+		}
+	}
+}
+
+// Binary value of the pixel with the (global) index `index` of the contour image
+static unsigned char grid_value(Band *band, long index) {
+	ppm_pixel curr_pixel = band->rows[index - (long)band->r0 * band->Y];
+	unsigned char curr_color = (curr_pixel.red + curr_pixel.green + curr_pixel.blue) / 3;
+
+	return curr_color > SIGMA ? 0 : 1;
+}
+
+// Step 1 of the algorithm for grid row `i` of the band
+static void sample_grid_row(Band *band, int i) {
+	int X = band->X, Y = band->Y, q = band->q;
+	unsigned char *row = band->grid[i - band->g0];
+
+	// The row below the last grid cell samples the last row of the image
+	if (i == band->p) {
+		for (int j = 0; j < q; j++) {
+			row[j] = grid_value(band, (long)(X - 1) * Y + j * STEP);
+		}
+		row[q] = 0;
+		return;
+	}
+
+	for (int j = 0; j < q; j++) {
+		row[j] = grid_value(band, (long)i * STEP * Y + j * STEP);
+	}
+
+	// Last sample points have no neighbors below / to the right, so we use pixels on the
+	// last row / column of the input image for them
+	if (band->last_column) {
+		row[q] = band->last_column[i];
+	} else {
+		row[q] = grid_value(band, (long)i * STEP * Y + X - 1);
+	}
+}
+
+// Posts the exchange of grid rows between neighbouring bands: the first grid row is sent
+// up, and the first grid row of the next band is received below the band, since it is
+// needed to march the last row of cells
+static void post_halo(Band *band, int rank, int num_procs, MPI_Request halo[2]) {
+	int up = rank > MASTER ? rank - 1 : MPI_PROC_NULL;
+	int down = rank < num_procs - 1 ? rank + 1 : MPI_PROC_NULL;
+
+	MPI_Irecv(band->grid[band->g1 - band->g0], band->q + 1, MPI_UNSIGNED_CHAR, down, 0,
+			  MPI_COMM_WORLD, &halo[0]);
+	MPI_Isend(band->grid[0], band->q + 1, MPI_UNSIGNED_CHAR, up, 0, MPI_COMM_WORLD, &halo[1]);
+}
+
+// Step 2 of the algorithm for the cells [j0, j1) of cell row `i`; same as update_image()
+// and march()
+static void march_row(Band *band, ppm_image **contour_map, int i, int j0, int j1) {
+	int Y = band->Y;
+	unsigned char *up = band->grid[i - band->g0];
+	unsigned char *down = band->grid[i - band->g0 + 1];
+
+	for (int j = j0; j < j1; j++) {
+		unsigned char k = 8 * up[j] + 4 * up[j + 1] + 2 * down[j + 1] + 1 * down[j];
+		ppm_image *contour = contour_map[k];
+
+		for (int a = 0; a < contour->x; a++) {
+			for (int b = 0; b < contour->y; b++) {
+				int contour_pixel_index = contour->x * a + b;
+				long image_pixel_index = (long)(i * STEP + a - band->r0) * Y + j * STEP + b;
+
+				band->rows[image_pixel_index] = contour->data[contour_pixel_index];
+			}
+		}
+	}
+}
+
+// Band of a process contoured by its threads. Thread 0 is the thread that initialized MPI,
+// so it funnels the halo exchange: the first grid row is sampled and sent before the rest
+// of the grid, and the rows of cells above the last one are marched while it is in flight.
+static void *thread_function(void *arg) {
+	ThreadData *data = (ThreadData *)arg;
+	Band *band = data->band;
+	int id = data->id, P = data->num_threads;
+
+	if (band->rescale) {
+		int n = band->r1 - band->r0;
+		int start = band->r0 + id * (double)n / P;
+		int end = band->r0 + (min((id + 1) * (double)n / P, n));
+		rescale_band(band, start, end);
+		pthread_barrier_wait(data->barrier);
+	}
+
+	if (id == 0) {
+		sample_grid_row(band, band->g0);
+		post_halo(band, data->rank, data->num_procs, data->halo);
+	}
+
+	// The last process also samples the row below the last grid cell
+	int first = band->g0 + 1;
+	int last = data->rank == data->num_procs - 1 ? band->g1 + 1 : band->g1;
+	int n = last - first;
+	int start = first + id * (double)n / P;
+	int end = first + (min((id + 1) * (double)n / P, n));
+	for (int i = start; i < end; i++) {
+		sample_grid_row(band, i);
+	}
+	pthread_barrier_wait(data->barrier);
+
+	// Interior rows of cells, which only need the grid of the band
+	n = band->g1 - 1 - band->g0;
+	start = band->g0 + id * (double)n / P;
+	end = band->g0 + (min((id + 1) * (double)n / P, n));
+	for (int i = start; i < end; i++) {
+		march_row(band, data->contour_map, i, 0, band->q);
+	}
+
+	if (id == 0) {
+		MPI_Waitall(2, data->halo, MPI_STATUSES_IGNORE);
+	}
+	pthread_barrier_wait(data->barrier);
+
+	// The last row of cells is split by columns
+	start = id * (double)band->q / P;
+	end = min((id + 1) * (double)band->q / P, band->q);
+	march_row(band, data->contour_map, band->g1 - 1, start, end);
+
+	return NULL;
+}
+
+// Contours the band of the process with `num_threads` threads
+static void parallel_marching_squares(Band *band, ppm_image **contour_map, int num_threads,
+									  int rank, int num_procs) {
+	pthread_t *threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+	ThreadData *data = (ThreadData *)malloc(num_threads * sizeof(ThreadData));
+	pthread_barrier_t barrier;
+	MPI_Request halo[2];
+
+	if (!threads || !data) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	pthread_barrier_init(&barrier, NULL, num_threads);
+
+	for (int i = 0; i < num_threads; i++) {
+		data[i].id = i;
+		data[i].num_threads = num_threads;
+		data[i].barrier = &barrier;
+		data[i].band = band;
+		data[i].contour_map = contour_map;
+		data[i].rank = rank;
+		data[i].num_procs = num_procs;
+		data[i].halo = halo;
+	}
+
+	// The calling thread runs as thread 0
+	for (int i = 1; i < num_threads; i++) {
+		int r = pthread_create(&threads[i], NULL, thread_function, &data[i]);
+		if (r) {
+			fprintf(stderr, "Error creating thread %d\n", i);
+			exit(-1);
+		}
+	}
+
+	thread_function(&data[0]);
+
+	for (int i = 1; i < num_threads; i++) {
+		int r = pthread_join(threads[i], NULL);
+		if (r) {
+			fprintf(stderr, "Error waiting for thread %d\n", i);
+			exit(-1);
+		}
+	}
+
+	pthread_barrier_destroy(&barrier);
+	free(threads);
+	free(data);
+}
+
+// The master reads the contour images and sends them to every process
+static ppm_image **bcast_contour_map(int rank) {
+	ppm_image **map = (ppm_image **)malloc(CONTOUR_CONFIG_COUNT * sizeof(ppm_image *));
+	if (!map) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	for (int i = 0; i < CONTOUR_CONFIG_COUNT; i++) {
+		int size[2];
+
+		if (rank == MASTER) {
+			char filename[FILENAME_MAX_SIZE];
+			sprintf(filename, "./contours/%d.ppm", i);
+			map[i] = read_ppm(filename);
+			size[0] = map[i]->x;
+			size[1] = map[i]->y;
+		}
+
+		MPI_Bcast(size, 2, MPI_INT, MASTER, MPI_COMM_WORLD);
+
+		if (rank != MASTER) {
+			map[i] = (ppm_image *)malloc(sizeof(ppm_image));
+			if (!map[i]) {
+				fprintf(stderr, "Unable to allocate memory\n");
+				exit(1);
+			}
+			map[i]->x = size[0];
+			map[i]->y = size[1];
+			map[i]->data = (ppm_pixel *)malloc(size[0] * size[1] * sizeof(ppm_pixel));
+			if (!map[i]->data) {
+				fprintf(stderr, "Unable to allocate memory\n");
+				exit(1);
+			}
+		}
+
+		MPI_Bcast(map[i]->data, size[0] * size[1] * 3, MPI_UNSIGNED_CHAR, MASTER, MPI_COMM_WORLD);
+	}
+
+	return map;
+}
+
+// Sends every process the pixels its band is computed from: the source columns of the
+// band when rescaling, the rows of the band otherwise
+static void scatter_source(Band *band, ppm_image *image, int rank, int num_procs) {
+	int *counts = (int *)malloc(num_procs * sizeof(int));
+	int *displs = (int *)malloc(num_procs * sizeof(int));
+	ppm_pixel *send = NULL;
+	int recv_count;
+
+	if (!counts || !displs) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	if (band->rescale) {
+		// The source columns are strided in memory, so the master packs them first
+		long total = 0;
+		for (int r = 0; r < num_procs; r++) {
+			Band other = *band;
+			compute_band(&other, r, num_procs);
+			total += (long)(other.cx1 - other.cx0) * band->sy;
+		}
+
+		if (rank == MASTER) {
+			send = (ppm_pixel *)malloc(total * sizeof(ppm_pixel));
+			if (!send) {
+				fprintf(stderr, "Unable to allocate memory\n");
+				exit(1);
+			}
+		}
+
+		long offset = 0;
+		for (int r = 0; r < num_procs; r++) {
+			Band other = *band;
+			compute_band(&other, r, num_procs);
+			int width = other.cx1 - other.cx0;
+
+			if (rank == MASTER) {
+				for (int y = 0; y < band->sy; y++) {
+					memcpy(&send[offset + (long)width * y], &image->data[other.cx0 + (long)band->sx * y],
+						   width * sizeof(ppm_pixel));
+				}
+			}
+
+			counts[r] = width * band->sy * 3;
+			displs[r] = offset * 3;
+			offset += (long)width * band->sy;
+		}
+
+		recv_count = (band->cx1 - band->cx0) * band->sy * 3;
+		band->source = (ppm_pixel *)malloc(recv_count);
+		band->rows = (ppm_pixel *)malloc((long)(band->r1 - band->r0) * band->Y * sizeof(ppm_pixel));
+	} else {
+		// The rows of the band are contiguous in the input image
+		for (int r = 0; r < num_procs; r++) {
+			Band other = *band;
+			compute_band(&other, r, num_procs);
+			counts[r] = (other.r1 - other.r0) * band->Y * 3;
+			displs[r] = other.r0 * band->Y * 3;
+		}
+
+		if (rank == MASTER) {
+			send = image->data;
+		}
+
+		recv_count = counts[rank];
+		band->rows = (ppm_pixel *)malloc(recv_count);
+	}
+
+	if ((band->rescale && !band->source) || !band->rows) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	MPI_Scatterv(send, counts, displs, MPI_UNSIGNED_CHAR,
+				 band->rescale ? (void *)band->source : (void *)band->rows, recv_count,
+				 MPI_UNSIGNED_CHAR, MASTER, MPI_COMM_WORLD);
+
+	if (band->rescale && rank == MASTER) {
+		free(send);
+	}
+	free(counts);
+	free(displs);
+}
+
+// Without rescaling, the last grid column samples pixels at flat index i * STEP * Y + X - 1,
+// which lie outside the band when X > Y; the master computes it from the whole image.
+static void bcast_last_column(Band *band, ppm_image *image, int rank) {
+	band->last_column = (unsigned char *)malloc(band->p + 1);
+	if (!band->last_column) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	if (rank == MASTER) {
+		for (int i = 0; i < band->p; i++) {
+			ppm_pixel curr_pixel = image->data[(long)i * STEP * band->Y + band->X - 1];
+			unsigned char curr_color = (curr_pixel.red + curr_pixel.green + curr_pixel.blue) / 3;
+			band->last_column[i] = curr_color > SIGMA ? 0 : 1;
+		}
+	}
+
+	MPI_Bcast(band->last_column, band->p, MPI_UNSIGNED_CHAR, MASTER, MPI_COMM_WORLD);
+}
+
+// Collects the bands of every process into `out` on the master
+static void gather_output(Band *band, ppm_image *out, int rank, int num_procs) {
+	int *counts = (int *)malloc(num_procs * sizeof(int));
+	int *displs = (int *)malloc(num_procs * sizeof(int));
+	if (!counts || !displs) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	for (int r = 0; r < num_procs; r++) {
+		Band other = *band;
+		compute_band(&other, r, num_procs);
+		counts[r] = (other.r1 - other.r0) * band->Y * 3;
+		displs[r] = other.r0 * band->Y * 3;
+	}
+
+	MPI_Gatherv(band->rows, counts[rank], MPI_UNSIGNED_CHAR, rank == MASTER ? out->data : NULL,
+				counts, displs, MPI_UNSIGNED_CHAR, MASTER, MPI_COMM_WORLD);
+
+	free(counts);
+	free(displs);
+}
+
+// Writes the contour image with collective MPI-IO: the master writes the P6 header and
+// every process writes its own rows at their offset in the file. `info` carries the
+// aggregation hints (e.g. cb_nodes, cb_buffer_size, romio_cb_write).
+static void write_collective(Band *band, const char *filename, MPI_Info info, int rank) {
+	char header[64];
+	int header_len = snprintf(header, sizeof(header), "P6\n%d %d\n%d\n", band->X, band->Y,
+							  RGB_COMPONENT_COLOR);
+	MPI_Offset total = header_len + (MPI_Offset)band->X * band->Y * sizeof(ppm_pixel);
+	MPI_File out;
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	double start = MPI_Wtime();
+
+	int r = MPI_File_open(MPI_COMM_WORLD, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, info, &out);
+	if (r) {
+		if (rank == MASTER) {
+			fprintf(stderr, "Unable to open file '%s'\n", filename);
+		}
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+
+	// Drop the previous contents of the file
+	MPI_File_set_size(out, total);
+
+	if (rank == MASTER) {
+		MPI_File_write_at(out, 0, header, header_len, MPI_CHAR, MPI_STATUS_IGNORE);
+	}
+
+	// The view starts after the header, so the bands are placed at their row offsets
+	MPI_File_set_view(out, header_len, MPI_BYTE, MPI_BYTE, "native", info);
+	MPI_File_write_at_all(out, (MPI_Offset)band->r0 * band->Y * sizeof(ppm_pixel), band->rows,
+						  (band->r1 - band->r0) * band->Y * sizeof(ppm_pixel), MPI_BYTE,
+						  MPI_STATUS_IGNORE);
+	MPI_File_close(&out);
+
+	double elapsed = MPI_Wtime() - start, max_elapsed;
+	MPI_Reduce(&elapsed, &max_elapsed, 1, MPI_DOUBLE, MPI_MAX, MASTER, MPI_COMM_WORLD);
+
+	if (rank == MASTER) {
+		printf("Wrote %lld bytes in %.3f ms (%.1f MB/s)\n", (long long)total, max_elapsed * 1e3,
+			   total / max_elapsed / 1e6);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int rank, num_procs, provided;
+
+	// Only the main thread of a process makes MPI calls
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
+
+	if (argc < 3) {
+		if (rank == MASTER) {
+			fprintf(stderr, "Usage: mpirun -np <N> ./tema1_mpi <in_file> <out_file> "
+					"[--threads <T>] [--time] [--collective-io] [--hint <key>=<value>]...\n");
+		}
+		MPI_Finalize();
+		return 1;
+	}
+
+	// Parse the optional arguments
+	int collective_io = 0, num_threads = 1, print_time = 0;
+	MPI_Info info;
+	MPI_Info_create(&info);
+
+	for (int i = 3; i < argc; i++) {
+		char *value = i + 1 < argc ? strchr(argv[i + 1], '=') : NULL;
+
+		if (!strcmp(argv[i], "--collective-io")) {
+			collective_io = 1;
+		} else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			num_threads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--time")) {
+			print_time = 1;
+		} else if (!strcmp(argv[i], "--hint") && value) {
+			*value = '\0';
+			MPI_Info_set(info, argv[i + 1], value + 1);
+			i++;
+		} else {
+			if (rank == MASTER) {
+				fprintf(stderr, "Unknown argument '%s'\n", argv[i]);
+			}
+			MPI_Finalize();
+			return 1;
+		}
+	}
+
+	// Use every CPU the process is bound to (e.g. its NUMA domain with --bind-to numa)
+	if (num_threads <= 0) {
+		cpu_set_t cpus;
+		sched_getaffinity(0, sizeof(cpus), &cpus);
+		num_threads = CPU_COUNT(&cpus);
+	}
+
+	if (num_threads > 1 && provided < MPI_THREAD_FUNNELED) {
+		if (rank == MASTER) {
+			fprintf(stderr, "The MPI library does not support threads\n");
+		}
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+
+	ppm_image *image = NULL;
+	int size[2];
+
+	if (rank == MASTER) {
+		image = read_ppm(argv[1]);
+		size[0] = image->x;
+		size[1] = image->y;
+	}
+	MPI_Bcast(size, 2, MPI_INT, MASTER, MPI_COMM_WORLD);
+
+	Band band;
+	memset(&band, 0, sizeof(band));
+	band.sx = size[0];
+	band.sy = size[1];
+
+	// We only rescale downwards
+	band.rescale = band.sx > RESCALE_X || band.sy > RESCALE_Y;
+	band.X = band.rescale ? RESCALE_X : band.sx;
+	band.Y = band.rescale ? RESCALE_Y : band.sy;
+	band.p = band.X / STEP;
+	band.q = band.Y / STEP;
+
+	if (band.p < num_procs) {
+		if (rank == MASTER) {
+			fprintf(stderr, "The image has fewer rows of cells (%d) than processes\n", band.p);
+		}
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+
+	compute_band(&band, rank, num_procs);
+
+	ppm_image **contour_map = bcast_contour_map(rank);
+
+	// Alloc memory for the grid rows of the band, including the one below it
+	band.grid = (unsigned char **)malloc((band.g1 - band.g0 + 1) * sizeof(unsigned char *));
+	if (!band.grid) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	for (int i = 0; i <= band.g1 - band.g0; i++) {
+		band.grid[i] = (unsigned char *)malloc((band.q + 1) * sizeof(unsigned char));
+		if (!band.grid[i]) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+	}
+
+	scatter_source(&band, image, rank, num_procs);
+	if (!band.rescale) {
+		bcast_last_column(&band, image, rank);
+	}
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	double start = MPI_Wtime();
+
+	parallel_marching_squares(&band, contour_map, num_threads, rank, num_procs);
+
+	double elapsed = MPI_Wtime() - start, max_elapsed;
+	MPI_Reduce(&elapsed, &max_elapsed, 1, MPI_DOUBLE, MPI_MAX, MASTER, MPI_COMM_WORLD);
+	if (print_time && rank == MASTER) {
+		printf("Contoured with %d processes x %d threads in %.3f ms\n", num_procs, num_threads,
+			   max_elapsed * 1e3);
+	}
+
+	if (collective_io) {
+		write_collective(&band, argv[2], info, rank);
+	}
+
+	// The master reuses the input image for the output when it is not rescaled
+	ppm_image *out = image;
+	if (rank == MASTER && band.rescale && !collective_io) {
+		out = (ppm_image *)malloc(sizeof(ppm_image));
+		if (!out) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+		out->x = band.X;
+		out->y = band.Y;
+		out->data = (ppm_pixel *)malloc((long)band.X * band.Y * sizeof(ppm_pixel));
+		if (!out->data) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+	}
+
+	if (!collective_io) {
+		gather_output(&band, out, rank, num_procs);
+	}
+
+	if (rank == MASTER) {
+		if (!collective_io) {
+			write_ppm(out, argv[2]);
+		}
+
+		if (out != image) {
+			free(out->data);
+			free(out);
+		}
+		free(image->data);
+		free(image);
+	}
+
+	for (int i = 0; i < CONTOUR_CONFIG_COUNT; i++) {
+		free(contour_map[i]->data);
+		free(contour_map[i]);
+	}
+	free(contour_map);
+
+	for (int i = 0; i <= band.g1 - band.g0; i++) {
+		free(band.grid[i]);
+	}
+	free(band.grid);
+	free(band.source);
+	free(band.rows);
+	free(band.last_column);
+
+	MPI_Info_free(&info);
+	MPI_Finalize();
+	return 0;
+}
@@ -1,256 +1,233 @@
 // Author: APD team, except where source was noted
 
 #include "helpers.h"
+#include "autotune.h"
+#include "marching.h"
+#include "pnm.h"
+#include "roi.h"
+#include "rss.h"
+#include "server.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <pthread.h>
-
-#define CONTOUR_CONFIG_COUNT    16
-#define FILENAME_MAX_SIZE       50
-#define STEP                    8
-#define SIGMA                   200
-#define RESCALE_X               2048
-#define RESCALE_Y               2048
-
-#define CLAMP(v, min, max) if(v < min) { v = min; } else if(v > max) { v = max; }
-
-// Find the minimum out of two numbers
-#define min(a, b) a < b ? a : b
-
-// Structure used to pass data to the thread function
-typedef struct {
-	int id;						// Thread identifier		
-	int num_threads;			// Total number of threads
-	pthread_barrier_t* barrier; // Synchronization barrier for threads
-	ppm_image* image;			// Pointer to the original image
-	ppm_image* scaled_image;
-	ppm_image** contour_map;
-	unsigned char** grid;
-	int step_x;
-	int step_y;
-} ThreadData;
-
-// Creates a map between the binary configuration (e.g. 0110_2) and the corresponding pixels
-// that need to be set on the output image. An array is used for this map since the keys are
-// binary numbers in 0-15. Contour images are located in the './contours' directory.
-ppm_image **init_contour_map() {
-	ppm_image **map = (ppm_image **)malloc(CONTOUR_CONFIG_COUNT * sizeof(ppm_image *));
-	if (!map) {
-		fprintf(stderr, "Unable to allocate memory\n");
-		exit(1);
-	}
 
-	for (int i = 0; i < CONTOUR_CONFIG_COUNT; i++) {
-		char filename[FILENAME_MAX_SIZE];
-		sprintf(filename, "./contours/%d.ppm", i);
-		map[i] = read_ppm(filename);
-	}
+int main(int argc, char *argv[]) {
+	// Server mode: keep the contexts warm and serve requests over a socket
+	if (argc >= 2 && !strcmp(argv[1], "--serve")) {
+		if (argc < 5) {
+			fprintf(stderr, "Usage: ./tema1_par --serve <socket_path> <P> <workers>\n");
+			return 1;
+		}
 
-	return map;
-}
+		return ms_serve(argv[2], atoi(argv[4]), atoi(argv[3]));
+	}
 
-// Updates a particular section of an image with the corresponding contour pixels.
-// Used to create the complete contour image.
-void update_image(ppm_image *image, ppm_image *contour, int x, int y) {
-	for (int i = 0; i < contour->x; i++) {
-		for (int j = 0; j < contour->y; j++) {
-			int contour_pixel_index = contour->x * i + j;
-			int image_pixel_index = (x + i) * image->y + y + j;
-
-			image->data[image_pixel_index].red = contour->data[contour_pixel_index].red;
-			image->data[image_pixel_index].green = contour->data[contour_pixel_index].green;
-			image->data[image_pixel_index].blue = contour->data[contour_pixel_index].blue;
+	// Client mode: send an image (or a statistics request) to a running server
+	if (argc >= 2 && !strcmp(argv[1], "--client")) {
+		if (argc == 4 && !strcmp(argv[3], "--stats")) {
+			return ms_client(argv[2], MS_REQ_STATS, NULL, NULL, 1, 0);
+		}
+		if (argc < 5) {
+			fprintf(stderr, "Usage: ./tema1_par --client <socket_path> <in_file> <out_file> [--memfd] [--repeat <n>] [--idle <ms>]\n"
+					"       ./tema1_par --client <socket_path> --stats\n");
+			return 1;
 		}
-	}
-}
 
-// Corresponds to step 1 of the marching squares algorithm, which focuses on sampling the image.
-// Builds a p x q grid of points with values which can be either 0 or 1, depending on how the
-// pixel values compare to the `sigma` reference value. The points are taken at equal distances
-// in the original image, based on the `step_x` and `step_y` arguments.
-unsigned char **sample_grid(unsigned char sigma, ThreadData* data) {
-	ppm_image *image = data->scaled_image;
-	int step_x = data->step_x;
-	int step_y = data->step_y;
-	int p = image->x / step_x;
-	int q = image->y / step_y;
-
-	// Compute the [start, end) section that the thread will work on
-	int start_i = data->id * (double)p / data->num_threads;
-	int end_i = min((data->id + 1) * (double)p / data->num_threads, p);
-
-	for (int i = start_i; i < end_i; i++) {
-		for (int j = 0; j < q; j++) {
-			ppm_pixel curr_pixel = image->data[i * step_x * image->y + j * step_y];
-
-			unsigned char curr_color = (curr_pixel.red + curr_pixel.green + curr_pixel.blue) / 3;
-
-			if (curr_color > sigma) {
-				data->grid[i][j] = 0;
+		int type = MS_REQ_INLINE, repeat = 1, idle_ms = 0;
+		for (int i = 5; i < argc; i++) {
+			if (!strcmp(argv[i], "--memfd")) {
+				type = MS_REQ_MEMFD;
+			} else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) {
+				repeat = atoi(argv[++i]);
+			} else if (!strcmp(argv[i], "--idle") && i + 1 < argc) {
+				idle_ms = atoi(argv[++i]);
 			} else {
-				data->grid[i][j] = 1;
+				fprintf(stderr, "Unknown argument '%s'\n", argv[i]);
+				return 1;
 			}
 		}
-	}
-	data->grid[p][q] = 0;
 
-	// Last sample points have no neighbors below / to the right, so we use pixels on the
-	// last row / column of the input image for them
-	for (int i = start_i; i < end_i; i++) {
-		ppm_pixel curr_pixel = image->data[i * step_x * image->y + image->x - 1];
+		return ms_client(argv[2], type, argv[3], argv[4], repeat, idle_ms);
+	}
 
-		unsigned char curr_color = (curr_pixel.red + curr_pixel.green + curr_pixel.blue) / 3;
+	// Autotuning mode: time the settings on this host and store the fastest ones
+	if (argc >= 2 && !strcmp(argv[1], "--autotune")) {
+		if (argc < 3) {
+			fprintf(stderr, "Usage: ./tema1_par --autotune <P> [profile_file]\n");
+			return 1;
+		}
 
-		if (curr_color > sigma) {
-			data->grid[i][q] = 0;
-		} else {
-			data->grid[i][q] = 1;
+		ms_profile profile;
+		if (ms_autotune(&profile, atoi(argv[2]), "./contours", stdout)) {
+			fprintf(stderr, "Autotuning failed\n");
+			return 1;
 		}
-	}
 
-	// Compute the [start, end) section that the thread will work on
-	int start_j = data->id * (double)q / data->num_threads;
-	int end_j = min((data->id + 1) * (double)q / data->num_threads, q);
+		return ms_profile_write(&profile, argc >= 4 ? argv[3] : MS_PROFILE_FILE) ? 1 : 0;
+	}
 
-	for (int j = start_j; j < end_j; j++) {
-		ppm_pixel curr_pixel = image->data[(image->x - 1) * image->y + j * step_y];
+	if (argc < 4) {
+		fprintf(stderr, "Usage: ./tema1 <in_file> <out_file> <P> [--report <json_file>] [--counters] [--trace <json_file>] [--regions <csv_file>] [--quadtree] [--mipmap] [--roi <x>,<y>,<w>,<h>] [--layout packed|rgbx|planar] [--low-memory] [--rss] [--no-tiling] [--profile <file>] [--no-profile]\n");
+		return 1;
+	}
 
-		unsigned char curr_color = (curr_pixel.red + curr_pixel.green + curr_pixel.blue) / 3;
+	// Get the threads number
+	int num_threads = *argv[3] - 48;
 
-		if (curr_color > sigma) {
-			data->grid[p][j] = 0;
+	// Parse the optional arguments
+	const char *report_file = NULL;
+	const char *regions_file = NULL;
+	int quadtree = 0, mipmap = 0;
+	int low_memory = 0, report_rss = 0, tiling = 1, tile_size = 0;
+	int roi[4] = { 0 }, use_roi = 0;
+	ms_layout layout = MS_LAYOUT_PACKED;
+	int layout_set = 0;
+	const char *profile_file = MS_PROFILE_FILE;
+	int use_counters = 0;
+	for (int i = 4; i < argc; i++) {
+		if (!strcmp(argv[i], "--report") && i + 1 < argc) {
+			report_file = argv[++i];
+		} else if (!strcmp(argv[i], "--regions") && i + 1 < argc) {
+			regions_file = argv[++i];
+		} else if (!strcmp(argv[i], "--quadtree")) {
+			quadtree = 1;
+		} else if (!strcmp(argv[i], "--mipmap")) {
+			mipmap = 1;
+		} else if (!strcmp(argv[i], "--layout") && i + 1 < argc) {
+			i++;
+			if (!strcmp(argv[i], "rgbx")) {
+				layout = MS_LAYOUT_RGBX;
+			} else if (!strcmp(argv[i], "planar")) {
+				layout = MS_LAYOUT_PLANAR;
+			} else if (strcmp(argv[i], "packed")) {
+				fprintf(stderr, "Unknown layout '%s'\n", argv[i]);
+				return 1;
+			}
+			layout_set = 1;
+		} else if (!strcmp(argv[i], "--profile") && i + 1 < argc) {
+			profile_file = argv[++i];
+		} else if (!strcmp(argv[i], "--no-profile")) {
+			profile_file = NULL;
+		} else if (!strcmp(argv[i], "--roi") && i + 1 < argc) {
+			int end = 0;
+			i++;
+			if (sscanf(argv[i], "%d,%d,%d,%d%n", &roi[0], &roi[1], &roi[2], &roi[3], &end) != 4
+				|| argv[i][end]) {
+				fprintf(stderr, "Invalid region '%s' (expected <x>,<y>,<w>,<h>)\n", argv[i]);
+				return 1;
+			}
+			use_roi = 1;
+		} else if (!strcmp(argv[i], "--low-memory")) {
+			low_memory = 1;
+		} else if (!strcmp(argv[i], "--rss")) {
+			report_rss = 1;
+		} else if (!strcmp(argv[i], "--no-tiling")) {
+			tiling = 0;
+		} else if (!strcmp(argv[i], "--counters")) {
+			use_counters = 1;
+		} else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+			trace_init(argv[++i]);
+			trace_thread("main", 0);
 		} else {
-			data->grid[p][j] = 1;
+			fprintf(stderr, "Unknown argument '%s'\n", argv[i]);
+			return 1;
 		}
 	}
 
-	return data->grid;
-}
-
-// Corresponds to step 2 of the marching squares algorithm, which focuses on identifying the
-// type of contour which corresponds to each subgrid. It determines the binary value of each
-// sample fragment of the original image and replaces the pixels in the original image with
-// the pixels of the corresponding contour image accordingly.
-void march(ppm_image *image, unsigned char **grid, ppm_image **contour_map,
-		   ThreadData* data) {
-	int p = image->x / data->step_x;
-	int q = image->y / data->step_y;
-
-	// Compute the [start, end) section that the thread will work on
-	int start_i = data->id * (double)p / data->num_threads;
-	int end_i = min((data->id + 1) * (double)p / data->num_threads, p);
-
-	for (int i = start_i; i < end_i; i++) {
-		for (int j = 0; j < q; j++) {
-			unsigned char k = 8 * grid[i][j] + 4 * grid[i][j + 1] + 
-							  2 * grid[i + 1][j + 1] + 1 * grid[i + 1][j];
-			update_image(image, contour_map[k], i * data->step_x, j * data->step_y);
-		}
+	// Hardware counters are reported next to the stage timings (on stdout by default)
+	if (use_counters && !report_file) {
+		report_file = "-";
 	}
-}
 
-// Rescale the original image to 2048x2048 using bicubic interpolation
-ppm_image *rescale_image(ThreadData* data) {
-	uint8_t sample[3];
+	// An autotuning profile, if there is one, sets the threads (up to P), the rescale tiles
+	// and the layout for the size class of the image; explicit options take precedence
+	ms_profile profile;
+	int w = roi[2], h = roi[3];
+	if (profile_file && !ms_profile_read(&profile, profile_file) &&
+		(use_roi || !read_pnm_size(argv[1], &w, &h))) {
+		const ms_tuning *tuning = ms_profile_lookup(&profile, w, h);
 
-	// We only rescale downwards
-	if (data->image->x <= RESCALE_X && data->image->y <= RESCALE_Y) {
-		return data->image;
+		if (tuning->num_threads < num_threads) {
+			num_threads = tuning->num_threads;
+		}
+		tile_size = tuning->tile_size;
+		if (!layout_set) {
+			layout = tuning->layout;
+		}
 	}
 
-	// Compute the [start, end) section that the thread will work on
-	int start_i = data->id * (double)data->scaled_image->x / data->num_threads;
-	int end_i = min((data->id + 1) * (double)data->scaled_image->x / data->num_threads,
-					 data->scaled_image->x);
-
-	// Use bicubic interpolation for scaling
-	for (int i = start_i; i < end_i; i++) {
-		for (int j = 0; j < data->scaled_image->y; j++) {
-			float u = (float)i / (float)(data->scaled_image->x - 1);
-			float v = (float)j / (float)(data->scaled_image->y - 1);
-			sample_bicubic(data->image, u, v, sample);
-
-			data->scaled_image->data[i * data->scaled_image->y + j].red = sample[0];
-			data->scaled_image->data[i * data->scaled_image->y + j].green = sample[1];
-			data->scaled_image->data[i * data->scaled_image->y + j].blue = sample[2];
+	// The memory used by the run is reported at the end in low-memory mode
+	ms_rss_monitor *rss = NULL;
+	if (low_memory || report_rss) {
+		rss = ms_rss_start(5);
+		if (!rss) {
+			fprintf(stderr, "Unable to start the memory monitor\n");
+			exit(1);
 		}
 	}
 
-	return data->scaled_image;
-}
-
-// Function that will be executed by each thread
-void* parallel_marching_squares(void* arg) {
-	ThreadData* data = (ThreadData*)arg;
-
-	// Rescale the original image
-	data->scaled_image = rescale_image(data);
-
-	// Wait for all threads to complete this stage before continuing
-	pthread_barrier_wait(data->barrier);
-
-	// Compute the grid for the scaled image
-	data->grid = sample_grid(SIGMA, data);
-
-	// Wait for all threads to complete this stage before continuing
-	pthread_barrier_wait(data->barrier);
-
-	// Create the contour image
-	march(data->scaled_image, data->grid, data->contour_map, data);
-	pthread_barrier_wait(data->barrier);
-
-	return NULL;
-}
-
-// Calls `free` method on the utilized resources
-void free_resources(ppm_image **image, ppm_image ***contour_map, unsigned char ***grid, int step_x, ppm_image **scaled_image) {
-    free((*scaled_image)->data);
-    free(*scaled_image);
-
-    for (int i = 0; i < CONTOUR_CONFIG_COUNT; i++) {
-        free((*contour_map)[i]->data);
-        free((*contour_map)[i]);
-    }
-    free(*contour_map);
-
-    for (int i = 0; i <= (*image)->x / step_x; i++) {
-        free((*grid)[i]);
-    }
-    free(*grid);
-
-    free((*image)->data);
-    free(*image);
-}
-
+	// The instrumentation is only enabled when a report is requested
+	ms_timing *timing = NULL;
+	if (report_file) {
+		timing = ms_timing_create(num_threads);
+		if (!timing) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
 
-int main(int argc, char *argv[]) {
-	if (argc < 4) {
-		fprintf(stderr, "Usage: ./tema1 <in_file> <out_file> <P>\n");
-		return 1;
+		if (use_counters) {
+			ms_timing_enable_counters(timing);
+		}
 	}
 
-	ppm_image *image = read_ppm(argv[1]);
-	int step_x = STEP;
-	int step_y = STEP;
-
-	ppm_image **contour_map = init_contour_map();
-
-	// Get the threads number
-	int num_threads = *argv[3] - 48;
-
-	// Create an array of threads
-	pthread_t threads[num_threads];
-
-	// Create an array of data that each thread will use
-	ThreadData thread_data[num_threads];
-
-	// Initialize a synchronization barrier that each thread will use
-	pthread_barrier_t barrier;
-	int r = pthread_barrier_init(&barrier, NULL, num_threads);
-	if (r) {
-		printf("The barrier cannot be initialized.\n");
+	trace_begin("read_ppm");
+	ms_stage_begin(timing ? &timing->main : NULL, STAGE_READ);
+	// With a region of interest, only the region is read and contoured
+	pnm_image *image;
+	if (use_roi) {
+		ppm_image *crop = read_ppm_roi(argv[1], roi[0], roi[1], roi[2], roi[3]);
+		image = (pnm_image *)calloc(1, sizeof(pnm_image));
+		if (!image) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+		image->x = crop->x;
+		image->y = crop->y;
+		image->maxval = RGB_COMPONENT_COLOR;
+		image->data = crop->data;
+		free(crop);
+	} else {
+		image = read_pnm(argv[1], num_threads);
+	}
+	ms_stage_end(timing ? &timing->main : NULL, STAGE_READ, (int64_t)image->x * image->y,
+				 (int64_t)image->x * image->y * (image->gray ? 1 : sizeof(ppm_pixel)));
+	trace_end("read_ppm");
+
+	// Create the context that owns the threads, the contour tiles and the grid
+	ms_context *ctx = ms_create(num_threads, "./contours");
+	if (!ctx) {
+		fprintf(stderr, "Unable to create the marching squares context\n");
+		exit(1);
+	}
+	ms_set_timing(ctx, timing);
+	ms_set_quadtree(ctx, quadtree);
+	ms_set_mipmap(ctx, mipmap);
+	ms_set_layout(ctx, layout);
+	ms_set_low_memory(ctx, low_memory);
+	ms_set_tiling(ctx, tiling);
+	ms_set_tile_size(ctx, tile_size);
+
+	// Label the regions of the grid while the image is contoured
+	ms_regions *regions = NULL;
+	if (regions_file) {
+		regions = ms_regions_create(num_threads);
+		if (!regions) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+		ms_set_regions(ctx, regions);
 	}
 
 	// Alloc memory for the new image
@@ -260,62 +237,64 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
-	scaled_image->x = RESCALE_X;
-	scaled_image->y = RESCALE_Y;
+	ms_output_size(image->x, image->y, &scaled_image->x, &scaled_image->y);
 
-	scaled_image->data = (ppm_pixel *)malloc(scaled_image->x * scaled_image->y * sizeof(ppm_pixel));
-	if (!scaled_image->data) {
-		fprintf(stderr, "Unable to allocate memory\n");
-		exit(1);
+	// Color images that are not rescaled are processed in place
+	if (image->data && scaled_image->x == image->x && scaled_image->y == image->y) {
+		scaled_image->data = image->data;
+	} else {
+		scaled_image->data = (ppm_pixel *)malloc(scaled_image->x * scaled_image->y * sizeof(ppm_pixel));
+		if (!scaled_image->data) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
 	}
 
-	int p = image->x / step_x;
-	int q = image->y / step_y;
-
-	// Alloc memory for the grid
-	unsigned char **grid = (unsigned char **)malloc((p + 1) * sizeof(unsigned char*));
-	if (!grid) {
+	// Grayscale images go to the grid without being widened to RGB
+	int r = image->gray ? ms_process_gray(ctx, image->gray, image->x, image->y, scaled_image) :
+						  ms_process(ctx, image->data, image->x, image->y, scaled_image);
+	if (r) {
 		fprintf(stderr, "Unable to allocate memory\n");
 		exit(1);
 	}
 
-	for (int i = 0; i <= p; i++) {
-		grid[i] = (unsigned char *)malloc((q + 1) * sizeof(unsigned char));
-		if (!grid[i]) {
-			fprintf(stderr, "Unable to allocate memory\n");
-			exit(1);
-		}
+	// Only the output is needed from here on
+	ms_destroy(ctx);
+	if (scaled_image->data != image->data) {
+		free_pnm(image);
+		image = NULL;
 	}
 
-	// Create the threads that will parallelize the marching squares algorithm
-	for (int i = 0; i < num_threads; i++) {
-		thread_data[i].id = i;
-		thread_data[i].image = image;
-		thread_data[i].scaled_image = scaled_image;
-		thread_data[i].grid = grid;
-		thread_data[i].step_x = step_x;
-		thread_data[i].step_y = step_y;
-		thread_data[i].num_threads = num_threads;
-		thread_data[i].contour_map = contour_map;
-		thread_data[i].barrier = &barrier;
-
-		pthread_create(&threads[i], NULL, parallel_marching_squares, &thread_data[i]);
+	// Write the computed image to the output file
+	trace_begin("write_ppm");
+	ms_stage_begin(timing ? &timing->main : NULL, STAGE_WRITE);
+	write_ppm(scaled_image, argv[2]);
+	ms_stage_end(timing ? &timing->main : NULL, STAGE_WRITE, (int64_t)scaled_image->x * scaled_image->y,
+				 (int64_t)scaled_image->x * scaled_image->y * sizeof(ppm_pixel));
+	trace_end("write_ppm");
+
+	if (regions) {
+		ms_regions_write_csv(regions, regions_file);
+		ms_regions_destroy(regions);
 	}
 
-	// Join the threads
-	for (int i = 0; i < num_threads; i++) {
-		pthread_join(threads[i], NULL);
+	if (timing) {
+		ms_timing_write_json(timing, report_file);
+		ms_timing_destroy(timing);
 	}
 
-	// Write the computed image to the output file
-	write_ppm(thread_data[num_threads - 1].scaled_image, argv[2]);
-
 	// Free the resources
-	free_resources(&image, &contour_map, &grid, step_x, &scaled_image);
+	if (image) {
+		free_pnm(image);
+	} else {
+		free(scaled_image->data);
+	}
+	free(scaled_image);
 
-	r = pthread_barrier_destroy(&barrier);
-	if (r) {
-		printf("The barrier cannot be destroyed.\n");
+	if (rss) {
+		long peak_kb, average_kb;
+		ms_rss_stop(rss, &peak_kb, &average_kb);
+		printf("Peak RSS: %ld KiB, average RSS: %ld KiB\n", peak_kb, average_kb);
 	}
 
 	return 0;
@@ -0,0 +1,285 @@
+// Per-stage, per-thread timing instrumentation for the marching squares pipeline
+
+#define TRACE_IMPLEMENTATION
+#include "timing.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define HW_CACHE_MISS(cache) \
+	((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const char *stage_names[STAGE_COUNT] = {
+	"read_ppm", "rescale_image", "sample_grid", "label_regions", "march", "write_ppm"
+};
+
+static const char *counter_names[COUNTER_COUNT] = {
+	"cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", "branch_misses"
+};
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+} counter_events[COUNTER_COUNT] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HW_CACHE, HW_CACHE_MISS(PERF_COUNT_HW_CACHE_L1D) },
+	{ PERF_TYPE_HW_CACHE, HW_CACHE_MISS(PERF_COUNT_HW_CACHE_LL) },
+	{ PERF_TYPE_HW_CACHE, HW_CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+const char *ms_stage_name(ms_stage stage) {
+	return stage_names[stage];
+}
+
+int64_t ms_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+ms_timing *ms_timing_create(int num_threads) {
+	ms_timing *timing = (ms_timing *)aligned_alloc(64, sizeof(ms_timing));
+	if (!timing) {
+		return NULL;
+	}
+	memset(timing, 0, sizeof(ms_timing));
+
+	timing->threads = (ms_thread_timing *)aligned_alloc(64, num_threads * sizeof(ms_thread_timing));
+	if (!timing->threads) {
+		free(timing);
+		return NULL;
+	}
+
+	memset(timing->threads, 0, num_threads * sizeof(ms_thread_timing));
+	timing->num_threads = num_threads;
+	timing->origin = ms_now_ns();
+
+	return timing;
+}
+
+static void close_counters(ms_thread_timing *t) {
+	if (t->use_counters != 2) {
+		return;
+	}
+
+	for (int c = 0; c < COUNTER_COUNT; c++) {
+		if (t->counter_fd[c] >= 0) {
+			close(t->counter_fd[c]);
+		}
+	}
+}
+
+void ms_timing_destroy(ms_timing *timing) {
+	if (timing) {
+		close_counters(&timing->main);
+		for (int i = 0; i < timing->num_threads; i++) {
+			close_counters(&timing->threads[i]);
+		}
+
+		free(timing->threads);
+		free(timing);
+	}
+}
+
+static void reset_thread(ms_thread_timing *t) {
+	memset(t->start, 0, sizeof(t->start));
+	memset(t->end, 0, sizeof(t->end));
+	memset(t->bytes, 0, sizeof(t->bytes));
+	memset(t->items, 0, sizeof(t->items));
+	memset(t->counters, 0, sizeof(t->counters));
+	memset(t->counter_mask, 0, sizeof(t->counter_mask));
+	t->barrier_wait = 0;
+	t->barrier_count = 0;
+}
+
+void ms_timing_reset(ms_timing *timing) {
+	reset_thread(&timing->main);
+	for (int i = 0; i < timing->num_threads; i++) {
+		reset_thread(&timing->threads[i]);
+	}
+	timing->origin = ms_now_ns();
+}
+
+void ms_timing_enable_counters(ms_timing *timing) {
+	timing->use_counters = 1;
+	timing->main.use_counters = 1;
+	for (int i = 0; i < timing->num_threads; i++) {
+		timing->threads[i].use_counters = 1;
+	}
+}
+
+// Opens the counters of the calling thread. Events that the host (or a VM, or the
+// perf_event_paranoid setting) does not allow are left out of the report.
+static void open_counters(ms_thread_timing *t) {
+	for (int c = 0; c < COUNTER_COUNT; c++) {
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = counter_events[c].type;
+		attr.config = counter_events[c].config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		t->counter_fd[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+
+	t->use_counters = 2;
+}
+
+void ms_counters_begin(ms_thread_timing *t) {
+	if (t->use_counters == 1) {
+		open_counters(t);
+	}
+
+	for (int c = 0; c < COUNTER_COUNT; c++) {
+		if (t->counter_fd[c] >= 0 &&
+			read(t->counter_fd[c], t->counter_start[c], sizeof(t->counter_start[c])) < 0) {
+			close(t->counter_fd[c]);
+			t->counter_fd[c] = -1;
+		}
+	}
+}
+
+void ms_counters_end(ms_thread_timing *t, ms_stage stage) {
+	for (int c = 0; c < COUNTER_COUNT; c++) {
+		uint64_t value[3];
+
+		if (t->counter_fd[c] < 0 || read(t->counter_fd[c], value, sizeof(value)) < 0) {
+			continue;
+		}
+
+		// The kernel multiplexes the events when there are more than the PMU can
+		// count at once, so extrapolate from the time the event was actually running
+		double delta = value[0] - t->counter_start[c][0];
+		uint64_t enabled = value[1] - t->counter_start[c][1];
+		uint64_t running = value[2] - t->counter_start[c][2];
+		if (running && running < enabled) {
+			delta *= (double)enabled / running;
+		}
+
+		t->counters[stage][c] += (int64_t)delta;
+		t->counter_mask[stage] |= 1 << c;
+	}
+}
+
+static double to_ms(ms_timing *timing, int64_t ns) {
+	return ns ? (ns - timing->origin) / 1e6 : 0;
+}
+
+// Writes the hardware counters of a stage together with the derived IPC and the misses per
+// item (pixel or grid point) of the stage
+static void write_counters(FILE *fp, ms_thread_timing *t, ms_stage s) {
+	int mask = t->counter_mask[s];
+	int64_t *counters = t->counters[s];
+	int64_t items = t->items[s];
+
+	fprintf(fp, ", \"counters\": {");
+	for (int c = 0, first = 1; c < COUNTER_COUNT; c++) {
+		if (mask & (1 << c)) {
+			fprintf(fp, "%s\"%s\": %lld", first ? "" : ", ", counter_names[c], (long long)counters[c]);
+			first = 0;
+		}
+	}
+
+	if ((mask & (1 << COUNTER_CYCLES)) && (mask & (1 << COUNTER_INSTRUCTIONS)) &&
+		counters[COUNTER_CYCLES]) {
+		fprintf(fp, ", \"ipc\": %.3f", (double)counters[COUNTER_INSTRUCTIONS] / counters[COUNTER_CYCLES]);
+	}
+
+	for (int c = COUNTER_L1D_MISSES; c <= COUNTER_DTLB_MISSES && items; c++) {
+		if (mask & (1 << c)) {
+			fprintf(fp, ", \"%s_per_item\": %.4f", counter_names[c], (double)counters[c] / items);
+		}
+	}
+	fprintf(fp, "}");
+}
+
+// Writes the stages recorded by one thread; stages that never ran are skipped
+static void write_stages(FILE *fp, ms_timing *timing, ms_thread_timing *t, const char *indent) {
+	int first = 1;
+
+	for (int s = 0; s < STAGE_COUNT; s++) {
+		if (!t->start[s]) {
+			continue;
+		}
+
+		fprintf(fp, "%s\n%s\"%s\": {\"start_ms\": %.3f, \"end_ms\": %.3f, \"duration_ms\": %.3f, "
+				"\"items\": %lld, \"bytes\": %lld", first ? "" : ",", indent, stage_names[s],
+				to_ms(timing, t->start[s]), to_ms(timing, t->end[s]),
+				(t->end[s] - t->start[s]) / 1e6, (long long)t->items[s], (long long)t->bytes[s]);
+		if (t->counter_mask[s]) {
+			write_counters(fp, t, s);
+		}
+		fprintf(fp, "}");
+		first = 0;
+	}
+}
+
+int ms_timing_write_json(ms_timing *timing, const char *filename) {
+	FILE *fp = strcmp(filename, "-") ? fopen(filename, "w") : stdout;
+	if (!fp) {
+		fprintf(stderr, "Unable to open file '%s'\n", filename);
+		return -1;
+	}
+
+	// Merge the per-thread measurements into a wall-clock view of every stage
+	ms_thread_timing all = timing->main;
+	for (int i = 0; i < timing->num_threads; i++) {
+		ms_thread_timing *t = &timing->threads[i];
+
+		for (int s = 0; s < STAGE_COUNT; s++) {
+			if (!t->start[s]) {
+				continue;
+			}
+			if (!all.start[s] || t->start[s] < all.start[s]) {
+				all.start[s] = t->start[s];
+			}
+			if (t->end[s] > all.end[s]) {
+				all.end[s] = t->end[s];
+			}
+			all.items[s] += t->items[s];
+			all.bytes[s] += t->bytes[s];
+
+			for (int c = 0; c < COUNTER_COUNT; c++) {
+				all.counters[s][c] += t->counters[s][c];
+			}
+			all.counter_mask[s] |= t->counter_mask[s];
+		}
+		all.barrier_wait += t->barrier_wait;
+	}
+
+	fprintf(fp, "{\n  \"threads\": %d,\n  \"total_ms\": %.3f,\n", timing->num_threads,
+			(ms_now_ns() - timing->origin) / 1e6);
+	if (timing->use_counters && !all.counter_mask[STAGE_READ]) {
+		fprintf(stderr, "Hardware counters are not available (see perf_event_paranoid)\n");
+	}
+	fprintf(fp, "  \"barrier_wait_ms\": %.3f,\n  \"stages\": {", all.barrier_wait / 1e6);
+	write_stages(fp, timing, &all, "    ");
+	fprintf(fp, "\n  },\n  \"per_thread\": [");
+
+	for (int i = 0; i < timing->num_threads; i++) {
+		ms_thread_timing *t = &timing->threads[i];
+
+		fprintf(fp, "%s\n    {\n      \"id\": %d,\n      \"barrier_wait_ms\": %.3f,\n"
+				"      \"barrier_count\": %d,\n      \"stages\": {", i ? "," : "", i,
+				t->barrier_wait / 1e6, t->barrier_count);
+		write_stages(fp, timing, t, "        ");
+		fprintf(fp, "\n      }\n    }");
+	}
+	fprintf(fp, "\n  ]\n}\n");
+
+	if (fp != stdout) {
+		fclose(fp);
+	}
+
+	return 0;
+}
@@ -0,0 +1,98 @@
+// Per-stage, per-thread timing instrumentation for the marching squares pipeline
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+
+// Stages of the pipeline; read and write run on the main thread only
+typedef enum {
+    STAGE_READ,
+    STAGE_RESCALE,
+    STAGE_GRID,
+    STAGE_REGIONS,
+    STAGE_MARCH,
+    STAGE_WRITE,
+    STAGE_COUNT
+} ms_stage;
+
+// Hardware counters sampled with perf_event_open() when enabled
+typedef enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_L1D_MISSES,
+    COUNTER_LLC_MISSES,
+    COUNTER_DTLB_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_COUNT
+} ms_counter;
+
+// Measurements of a single thread, padded to a cache line to avoid false sharing
+typedef struct {
+    int64_t start[STAGE_COUNT];     // CLOCK_MONOTONIC timestamps, in nanoseconds
+    int64_t end[STAGE_COUNT];
+    int64_t bytes[STAGE_COUNT];     // Bytes processed in each stage
+    int64_t items[STAGE_COUNT];     // Pixels or grid points processed in each stage
+    int64_t barrier_wait;           // Nanoseconds spent in pthread_barrier_wait()
+    int barrier_count;
+
+    int use_counters;               // Set when the hardware counters are enabled
+    int counter_fd[COUNTER_COUNT];  // Opened by the owning thread, -1 if unsupported
+    uint64_t counter_start[COUNTER_COUNT][3];
+    int64_t counters[STAGE_COUNT][COUNTER_COUNT];
+    int counter_mask[STAGE_COUNT];  // Bit c is set when counter c was read in the stage
+} __attribute__((aligned(64))) ms_thread_timing;
+
+typedef struct {
+    int num_threads;
+    int use_counters;
+    int64_t origin;
+    ms_thread_timing main;          // Stages run by the main thread
+    ms_thread_timing *threads;      // Stages run by the workers
+} ms_timing;
+
+// Name of a stage, as it appears in the reports
+const char *ms_stage_name(ms_stage stage);
+
+// Reads CLOCK_MONOTONIC, in nanoseconds
+int64_t ms_now_ns(void);
+
+ms_timing *ms_timing_create(int num_threads);
+void ms_timing_destroy(ms_timing *timing);
+
+// Clears the measurements so that the next job is reported on its own
+void ms_timing_reset(ms_timing *timing);
+
+// Samples the hardware counters of every thread around each stage
+void ms_timing_enable_counters(ms_timing *timing);
+
+// Snapshot / accumulate the counters of the calling thread, which must own `t`
+void ms_counters_begin(ms_thread_timing *t);
+void ms_counters_end(ms_thread_timing *t, ms_stage stage);
+
+static inline void ms_stage_begin(ms_thread_timing *t, ms_stage stage) {
+    if (t) {
+        if (t->use_counters) {
+            ms_counters_begin(t);
+        }
+        t->start[stage] = ms_now_ns();
+    }
+}
+
+// `items` counts the pixels (read, rescale, march, write) or the grid points (grid,
+// regions) of the stage, and `bytes` their size
+static inline void ms_stage_end(ms_thread_timing *t, ms_stage stage, int64_t items, int64_t bytes) {
+    if (t) {
+        t->end[stage] = ms_now_ns();
+        t->items[stage] += items;
+        t->bytes[stage] += bytes;
+        if (t->use_counters) {
+            ms_counters_end(t, stage);
+        }
+    }
+}
+
+// Writes the JSON summary to `filename` ("-" for stdout). Returns 0 on success.
+int ms_timing_write_json(ms_timing *timing, const char *filename);
+
+#endif
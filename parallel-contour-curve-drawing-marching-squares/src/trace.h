@@ -0,0 +1,194 @@
+// Thread timeline tracing in the Chrome trace / Perfetto JSON format.
+//
+// Every thread appends begin/end events to its own buffer, so recording takes no
+// locks; the buffers are merged into a JSON file when the program exits. Tracing
+// is disabled (and every call returns right away) unless trace_init() receives a
+// file name. Exactly one source file must define TRACE_IMPLEMENTATION before
+// including this header. The lab programs pass getenv("TRACE_FILE") to trace_init(),
+// so their timeline is written to $TRACE_FILE, if set. This is the only copy of the
+// tracer; laboratoare/lab02 and laboratoare/lab03 link to it.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#define TRACE_MAX_THREADS       256
+#define TRACE_MAX_EVENTS        (1 << 16)
+
+// Enables tracing; the timeline is written to `filename` at exit. NULL keeps it disabled.
+void trace_init(const char *filename);
+
+// Names the timeline of the calling thread (e.g. "worker", 3 -> "worker 3")
+void trace_thread(const char *label, int id);
+
+// Opens / closes a slice on the timeline of the calling thread. `name` must be a
+// string literal or otherwise outlive the program.
+void trace_begin(const char *name);
+void trace_end(const char *name);
+
+// Writes the timeline now instead of at exit
+void trace_flush(void);
+
+#ifdef TRACE_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef struct {
+    const char *name;
+    int64_t ts;
+    char phase;
+} trace_event;
+
+typedef struct {
+    char label[32];
+    int count;
+    int dropped;
+    trace_event events[TRACE_MAX_EVENTS];
+} trace_buffer;
+
+static const char *trace_filename;
+static int64_t trace_origin;
+static int trace_num_buffers;
+static trace_buffer *trace_buffers[TRACE_MAX_THREADS];
+static __thread trace_buffer *trace_local;
+
+static int64_t trace_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Returns the buffer of the calling thread, claiming a slot on the first call
+static trace_buffer *trace_get_buffer() {
+    if (trace_local) {
+        return trace_local;
+    }
+
+    int slot = __atomic_fetch_add(&trace_num_buffers, 1, __ATOMIC_RELAXED);
+    if (slot >= TRACE_MAX_THREADS) {
+        return NULL;
+    }
+
+    trace_buffer *buffer = (trace_buffer *)calloc(1, sizeof(trace_buffer));
+    if (!buffer) {
+        return NULL;
+    }
+
+    snprintf(buffer->label, sizeof(buffer->label), "thread %d", slot);
+    __atomic_store_n(&trace_buffers[slot], buffer, __ATOMIC_RELEASE);
+    trace_local = buffer;
+
+    return buffer;
+}
+
+static void trace_record(const char *name, char phase) {
+    if (!trace_filename) {
+        return;
+    }
+
+    trace_buffer *buffer = trace_get_buffer();
+    if (!buffer) {
+        return;
+    }
+
+    if (buffer->count == TRACE_MAX_EVENTS) {
+        buffer->dropped++;
+        return;
+    }
+
+    trace_event *event = &buffer->events[buffer->count];
+    event->name = name;
+    event->ts = trace_now();
+    event->phase = phase;
+    buffer->count++;
+}
+
+void trace_begin(const char *name) {
+    trace_record(name, 'B');
+}
+
+void trace_end(const char *name) {
+    trace_record(name, 'E');
+}
+
+void trace_thread(const char *label, int id) {
+    if (!trace_filename) {
+        return;
+    }
+
+    trace_buffer *buffer = trace_get_buffer();
+    if (buffer) {
+        snprintf(buffer->label, sizeof(buffer->label), "%s %d", label, id);
+    }
+}
+
+void trace_flush(void) {
+    if (!trace_filename) {
+        return;
+    }
+
+    FILE *fp = fopen(trace_filename, "w");
+    if (!fp) {
+        fprintf(stderr, "Unable to open file '%s'\n", trace_filename);
+        return;
+    }
+
+    int num_buffers = __atomic_load_n(&trace_num_buffers, __ATOMIC_ACQUIRE);
+    if (num_buffers > TRACE_MAX_THREADS) {
+        num_buffers = TRACE_MAX_THREADS;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    const char *separator = "\n";
+
+    for (int i = 0; i < num_buffers; i++) {
+        trace_buffer *buffer = __atomic_load_n(&trace_buffers[i], __ATOMIC_ACQUIRE);
+        if (!buffer) {
+            continue;
+        }
+
+        fprintf(fp, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                "\"args\": {\"name\": \"%s\"}}", separator, i, buffer->label);
+        separator = ",\n";
+
+        for (int j = 0; j < buffer->count; j++) {
+            trace_event *event = &buffer->events[j];
+            fprintf(fp, ",\n{\"name\": \"%s\", \"ph\": \"%c\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f}",
+                    event->name, event->phase, i, (event->ts - trace_origin) / 1e3);
+        }
+
+        if (buffer->dropped) {
+            fprintf(stderr, "trace: %s dropped %d events\n", buffer->label, buffer->dropped);
+        }
+    }
+
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+}
+
+// Writes the timeline once, when the program exits
+static void trace_at_exit() {
+    trace_flush();
+
+    for (int i = 0; i < trace_num_buffers && i < TRACE_MAX_THREADS; i++) {
+        free(trace_buffers[i]);
+        trace_buffers[i] = NULL;
+    }
+    trace_filename = NULL;
+}
+
+void trace_init(const char *filename) {
+    if (!filename || !*filename || trace_filename) {
+        return;
+    }
+
+    trace_origin = trace_now();
+    trace_filename = filename;
+    atexit(trace_at_exit);
+}
+
+#endif
+
+#endif